@@ -1,10 +1,17 @@
 #include <iostream>
 #include <atomic>
 #include <cassert>
+#include <mutex>
+#include <optional>
 #include "test_pool.h"
+#include "../../impls/coroutine_queue/waiter_list.h"
 
 /*
 Design a bounded lock-based and then lock free queue
+
+async_enq / async_deq park the calling coroutine instead of failing. The index
+stores are seq_cst (rather than release) because the waiter list needs the
+publish to be ordered before its own load of the waiter list.
 */
 
 template<
@@ -42,7 +49,9 @@ struct LockingQueue
 
         new (&_data[tailIndex]) T(std::forward<Args>(args)...);
 
-        tail.store(nextTailIndex, std::memory_order_release);
+        tail.store(nextTailIndex, std::memory_order_seq_cst);
+        lk.unlock();
+        deqWaiters.wake_all();
         return true;
     }
 
@@ -67,10 +76,39 @@ struct LockingQueue
             nextHeadIndex = 0;
         }
 
-        head.store(nextHeadIndex, std::memory_order_release);
+        head.store(nextHeadIndex, std::memory_order_seq_cst);
+        lk.unlock();
+        enqWaiters.wake_all();
         return res;
     }
 
+    task<void> async_enq(T item)
+    {
+        while(!enq(std::move(item)))
+        {
+            co_await enqWaiters.park([this](){ return !full(); });
+        }
+    }
+
+    task<T> async_deq()
+    {
+        while(true)
+        {
+            auto res = deq();
+            if(res)
+            {
+                co_return std::move(*res);
+            }
+            co_await deqWaiters.park([this](){ return !empty(); });
+        }
+    }
+
+    [[nodiscard]]
+    bool empty()
+    {
+        return head.load() == tail.load();
+    }
+
     [[nodiscard]]
     size_t size()
     {
@@ -85,6 +123,17 @@ struct LockingQueue
 
 
 private:
+    bool full()
+    {
+        auto nextTailIndex = tail.load() + 1;
+        if(nextTailIndex == _capacity)
+        {
+            nextTailIndex = 0;
+        }
+        return nextTailIndex == head.load();
+    }
+
+
     size_t _capacity;
     Allocator _allocator;
     T* _data;
@@ -92,10 +141,41 @@ private:
     std::mutex deqLock;
     std::atomic<size_t> head;
     std::atomic<size_t> tail;
+    waiter_list enqWaiters;
+    waiter_list deqWaiters;
 };
 
+/*
+    A queue of capacity 2 (one usable slot) between one producer and one
+    consumer coroutine on a single thread: every value forces both sides to
+    park and be woken by the other.
+*/
+void async_test()
+{
+    LockingQueue<int> q{2};
+    inline_executor exec;
+    int sum = 0;
+
+    exec.spawn([](LockingQueue<int>& q) -> task<void> {
+        for(int i = 0; i < 1000; ++i)
+        {
+            co_await q.async_enq(i);
+        }
+    }(q));
+    exec.spawn([](LockingQueue<int>& q, int& sum) -> task<void> {
+        for(int i = 0; i < 1000; ++i)
+        {
+            sum += co_await q.async_deq();
+        }
+    }(q, sum));
+
+    exec.run();
+    assert(sum == 999 * 1000 / 2);
+}
+
 int main()
 {
     LockingQueue<int> q;
     test_pool(q);
+    async_test();
 }
@@ -1,10 +1,15 @@
 #pragma once
+#include <atomic>
 #include <cassert>
 #include <functional>
 #include <thread>
 #include <numeric>
 #include <algorithm>
 #include <iostream>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+#include "../../impls/StampedAllocator/memory_resource.h"
 
 using namespace std::placeholders;
 /*
@@ -16,6 +21,10 @@ using namespace std::placeholders;
     The readers read all values and keep their own track of frequency
 
     Each writer adds a fixed amount of data to the pool
+
+    Every thread's frequency map draws on a pool of its own (see
+    impls/StampedAllocator/memory_resource.h), so counting does not go
+    through malloc next to the pool under test.
 */
 
 #if defined(if_debug)
@@ -54,7 +63,7 @@ Map merge_maps(Map&& m1, Map& m2)
 template<typename Pool>
 void test_pool(Pool&& p)
 {
-    using int_map = std::unordered_map<size_t,size_t>;
+    using int_map = std::pmr::unordered_map<size_t,size_t>;
 
     auto writer_thread = [](Pool p, int_map& my_freqs, size_t vals_to_write)
     {
@@ -93,7 +102,16 @@ void test_pool(Pool&& p)
     };
 
     const size_t readers = 20, writers = 20, vals_to_write = 10000;
-    std::vector<int_map> reader_maps(readers), writer_maps(writers);
+    std::vector<pools::unsynchronized_pool<>> reader_pools(readers), writer_pools(writers);
+    std::vector<int_map> reader_maps, writer_maps;
+    for(auto& pool : reader_pools)
+    {
+        reader_maps.emplace_back(&pool);
+    }
+    for(auto& pool : writer_pools)
+    {
+        writer_maps.emplace_back(&pool);
+    }
     std::vector<std::thread> reader_threads, writer_threads;
     std::atomic<bool> read_signal{ true };
 
@@ -158,3 +176,99 @@ void test_pool(Pool&& p)
     }
 
 }
+
+/*
+    The other strategy, for structures that hand values over rather than
+    pool them: every value 0 .. total - 1 goes in once and must come out
+    exactly once.
+
+    seen[c] is what consumer c got, in the order it got it. With
+    per_producer set, values v / per_producer came from the same producer in
+    increasing order, and every consumer must see each producer's values in
+    that order too (FIFO structures).
+*/
+inline void assert_exactly_once(const std::vector<std::vector<int>>& seen, int total, int per_producer = 0)
+{
+    std::vector<bool> found(total);
+    int count = 0;
+    for(auto& s : seen)
+    {
+        std::vector<int> last(per_producer ? total / per_producer : 0, -1);
+        for(int x : s)
+        {
+            assert(x >= 0 && x < total);
+            assert(!found[x]);
+            found[x] = true;
+            ++count;
+            if(per_producer)
+            {
+                assert(x > last[x / per_producer]);
+                last[x / per_producer] = x;
+            }
+        }
+    }
+    assert(count == total);
+}
+
+enum class drain_mode
+{
+    // drain may come back with nothing: consumers go on until every value is out
+    until_all_out,
+    // drain blocks for exactly one value: each consumer takes its equal share
+    equal_shares,
+};
+
+/*
+    Producer p puts in the values p * per_producer ... (p + 1) * per_producer - 1
+    in increasing order: produce(p) does all of that, one at a time or in
+    batches. drain(c, out) is one go at taking values out (a deq, a drain-all,
+    a timed poll...), appending whatever consumer c got to out. Consumers start
+    first, so structures with reservations see waiting consumers.
+*/
+template<typename Produce, typename Drain>
+void producer_consumer_test(int producers, int consumers, int per_producer,
+        Produce produce, Drain drain,
+        drain_mode mode = drain_mode::until_all_out, bool fifo = false)
+{
+    const int total = producers * per_producer;
+    std::atomic<int> remaining{ total };
+    std::vector<std::vector<int>> seen(consumers);
+    std::vector<std::thread> threads;
+
+    for(int c = 0; c < consumers; ++c)
+    {
+        threads.emplace_back([&, c](){
+            auto& out = seen[c];
+            if(mode == drain_mode::equal_shares)
+            {
+                while(out.size() < static_cast<size_t>(total / consumers))
+                {
+                    drain(c, out);
+                }
+                return;
+            }
+            while(remaining.load() > 0)
+            {
+                const size_t before = out.size();
+                drain(c, out);
+                if(out.size() == before)
+                {
+                    std::this_thread::yield();
+                }
+                remaining -= static_cast<int>(out.size() - before);
+            }
+        });
+    }
+    for(int p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&produce, p](){
+            produce(p);
+        });
+    }
+    for(auto& th : threads)
+    {
+        th.join();
+    }
+
+    assert_exactly_once(seen, total, fifo ? per_producer : 0);
+}
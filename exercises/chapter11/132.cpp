@@ -129,7 +129,7 @@ private:
     const size_t capacity_;
     std::vector<T> data_;
     std::atomic<size_t> head = 0;
-    Rooms room_;
+    Rooms<> room_;
     static thread_local T popped_val;
 };
 
@@ -23,7 +23,9 @@ static_assert(is_power_of_2(8));
 static_assert(!is_power_of_2(9));
 
 #include <thread>
+#include "../../impls/backoff/backoff.h"
 
+template<typename Backoff = backoff::tiered<>>
 struct PetersonLock
 {
     std::vector<std::atomic<bool>> flags;
@@ -43,6 +45,7 @@ struct PetersonLock
         victim = thread_id;
         
         bool is_stopped = true;
+        Backoff backoff;
         while(is_stopped)
         {
             is_stopped = false;
@@ -54,6 +57,10 @@ struct PetersonLock
                 assert(other_thread - base_id < num_threads);
                 is_stopped = is_stopped || (victim == thread_id && flags[other_thread - base_id]);
             }
+            if(is_stopped)
+            {
+                backoff();
+            }
         }
 
     }
@@ -118,7 +125,7 @@ struct PetersonTreeLock
 
 private:
     static constexpr size_t root_node = 1;
-    std::array<std::unique_ptr<PetersonLock>, 2*N + 1> lock_tree;
+    std::array<std::unique_ptr<PetersonLock<>>, 2*N + 1> lock_tree;
     std::array<std::unique_ptr<const size_t>, 2*N + 1> thread_id_to_leaf;
 
 
@@ -130,7 +137,7 @@ private:
     {
         size_t range_size = range_end - range_start + 1;
 
-        lock_tree[my_idx] = std::make_unique<PetersonLock>(range_size, range_start);
+        lock_tree[my_idx] = std::make_unique<PetersonLock<>>(range_size, range_start);
 
         if(range_size == 1)
         {
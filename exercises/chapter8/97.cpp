@@ -2,6 +2,7 @@
 #include <iostream>
 #include <thread>
 #include <cassert>
+#include "../../impls/backoff/backoff.h"
 
 struct IRooms
 {
@@ -11,7 +12,10 @@ struct IRooms
 
 /*
    Just really beautiful code.
+
+   Waiting for another room to empty, and lost CASes, back off with Backoff.
 */
+template<typename Backoff = backoff::tiered<>>
 struct Rooms : IRooms
 {
     Rooms()
@@ -20,7 +24,7 @@ struct Rooms : IRooms
 
     void enter(int i)
     {
-        while(true)
+        for(Backoff backoff; ; backoff())
         {
             room_state local_state = curr_state.load(std::memory_order_acquire);
 
@@ -54,7 +58,7 @@ struct Rooms : IRooms
         requires std::invocable<F>
     bool exit(F&& f)
     {
-        while(true)
+        for(Backoff backoff; ; backoff())
         {
             room_state local_state = curr_state.load(std::memory_order_acquire);
 
@@ -1,66 +1,187 @@
-#include <unordered_map>
-#include "ThreadLocalDynamic.h"
-#include "../StampedAllocator/StampedAllocator.h"
+#include "MultithreadAlloc.h"
+#include "../lock_free_stack/thread_safe_alloc.h"
+#include "../StampedAllocator/lock_free_allocator.h"
+#include "../mrmw_queue/mrmw_queue.h"
+#include <cassert>
+#include <chrono>
+#include <format>
+#include <iostream>
+#include <set>
+#include <thread>
+#include <vector>
 
+using namespace sidney3;
 
-namespace sidney3
+struct message
 {
-template<
-    typename BackupAllocator, 
-    typename DefaultAllocator>
-struct FailureAllocator : DefaultAllocator
+    size_t producer;
+    size_t seq;
+};
+
+template<typename U>
+struct queue_traits<StampedRefNormal<U>>
 {
-    using pointer = std::allocator_traits<BackupAllocator>::pointer;
-    static_assert(std::is_same_v<
-            pointer, 
-            typename std::allocator_traits<DefaultAllocator>::pointer>);
+    static StampedRefNormal<U> empty_value() { return nullptr; }
+};
 
-    FailureAllocator(DefaultAllocator *failureAlloc)
-        : failureAlloc_{failureAlloc}
-    {}
+using ref = StampedRefNormal<message>;
+using principal = principal_slabs<message>;
+template<size_t Batch>
+using multithread = MultithreadAlloc<message, principal, thread_pool<message, ref, Batch>>;
 
-    pointer allocate(const size_t count)
+void single_thread_test()
+{
+    multithread<4> alloc;
+    std::vector<ref> refs;
+    for(size_t i = 0; i < 100; ++i)
+    {
+        refs.push_back(alloc.construct(0ul, i));
+    }
+    std::set<message*> seen;
+    for(auto r : refs)
+    {
+        assert(seen.insert(r.get_ptr()).second && r.getStamp() == 0);
+        alloc.free(r);
+    }
+    // handed off 4 at a time whenever the thread had 8, so 4 stay with it
+    assert(alloc.central().blocks() == 96);
+    for(auto& r : refs)
+    {
+        r = alloc.allocate();
+        assert(seen.count(r.get_ptr()) == 1 && r.getStamp() == 1);
+    }
+    assert(alloc.principal().carved() == 100 && alloc.central().blocks() == 0);
+    for(auto r : refs)
     {
-        pointer _ptr = DefaultAllocator::allocate(count);
+        alloc.deallocate(r);
+    }
+}
 
-        if(!_ptr)
+/*
+    One thread allocates everything, a second frees it all, a third
+    allocates again: with the hand-off the third is served from what the
+    second freed, without it the principal carves everything twice.
+*/
+template<size_t Batch>
+size_t hand_off_test()
+{
+    static constexpr size_t count = 1000;
+    multithread<Batch> alloc;
+    std::vector<ref> refs;
+
+    std::thread([&](){
+        for(size_t i = 0; i < count; ++i)
         {
-            _ptr = failureAlloc_->allocate(count);
-            assert(_ptr 
-                    && "Backup allocator must succeed at allocation");
+            refs.push_back(alloc.construct(0ul, i));
         }
-
-        return _ptr;
-    }
-
-    void deallocate(pointer ptr, size_t count)
-    {
-        if(!DefaultAllocator::deallocate(ptr, count))
+    }).join();
+    std::thread([&](){
+        for(auto r : refs)
         {
-            bool backupSuccess = failureAlloc_->deallocate(ptr, count);
-            assert(backupSuccess 
-                    && "backup allocator must succeed at deallocation");
+            alloc.free(r);
         }
-    }
-
+    }).join();
+    std::thread([&](){
+        std::set<message*> seen;
+        for(auto& r : refs)
+        {
+            r = alloc.construct(2ul, 0ul);
+            assert(seen.insert(r.get_ptr()).second);
+        }
+    }).join();
+    return alloc.principal().carved();
+}
 
-private:
-    BackupAllocator *failureAlloc_;
+struct run_stats
+{
+    long long ns;
+    size_t footprint;
 };
 
+/*
+    Producers allocate messages and pass them through a queue, consumers
+    check and free them. Every message is seen exactly once. footprint is
+    how many blocks MultithreadAlloc carved (0 for the others).
+*/
+template<typename Allocator>
+run_stats pass_messages(size_t producers, size_t consumers)
+{
+    static constexpr size_t total = 1 << 17;
+    const size_t per_producer = total / producers;
+    Allocator alloc;
+    MRMWQueue<ref> queue{1024};
+    std::atomic<size_t> consumed{ 0 };
+    std::atomic<size_t> seq_sum{ 0 };
+    std::vector<std::thread> workers;
+
+    auto start_time = std::chrono::steady_clock::now();
+    for(size_t p = 0; p < producers; ++p)
+    {
+        workers.emplace_back([&, p](){
+            for(size_t i = 0; i < per_producer; ++i)
+            {
+                ref m = alloc.allocate();
+                new (m.get_ptr()) message{p, i};
+                while(!queue.enq(m))
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for(size_t c = 0; c < consumers; ++c)
+    {
+        workers.emplace_back([&, producers](){
+            size_t sum = 0;
+            while(consumed.load(std::memory_order_relaxed) < per_producer * producers)
+            {
+                auto m = queue.deq();
+                if(!m)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+                assert((*m)->producer < producers);
+                sum += (*m)->seq;
+                alloc.deallocate(*m);
+                consumed.fetch_add(1, std::memory_order_relaxed);
+            }
+            seq_sum += sum;
+        });
+    }
+    for(auto& th : workers)
+    {
+        th.join();
+    }
+    auto total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_time);
+
+    assert(seq_sum.load() == producers * (per_producer * (per_producer - 1) / 2));
+    size_t footprint = 0;
+    if constexpr(requires { alloc.principal().carved(); })
+    {
+        footprint = alloc.principal().carved();
+    }
+    return { total_time.count() / static_cast<long long>(per_producer * producers), footprint };
+}
 
-template<
-    typename T,
-    typename PrincipleAlloc,
-    typename ThreadLocalAlloc
-    >
-struct MultithreadAlloc
+int main()
 {
-private:
-    PrincipleAlloc mainAllocator;
-    ThreadLocal<
-        MultithreadAlloc, FailureAllocator<PrincipleAlloc, ThreadLocalAlloc>
-        > threadLocalAllocator;
-};
+    single_thread_test();
+    assert(hand_off_test<0>() == 2000);
+    // the freeing thread keeps fewer than 2 * Batch
+    assert(hand_off_test<16>() < 1000 + 32);
 
-} // namespace sidney3
+    for(size_t threads = 1; threads <= 4; threads *= 2)
+    {
+        auto mutex = pass_messages<ThreadSafeAllocator<message>>(threads, threads);
+        auto lock_free = pass_messages<LockFreeStampedAllocator<message>>(threads, threads);
+        auto local_only = pass_messages<multithread<0>>(threads, threads);
+        auto balanced = pass_messages<multithread<64>>(threads, threads);
+        std::cout << std::format("{} producers, {} consumers: ThreadSafeAllocator {}ns/message, "
+                "LockFreeStampedAllocator {}ns; thread-local lists only {}ns, {} blocks; "
+                "with central hand-off {}ns, {} blocks\n",
+                threads, threads, mutex.ns, lock_free.ns, local_only.ns, local_only.footprint,
+                balanced.ns, balanced.footprint);
+    }
+}
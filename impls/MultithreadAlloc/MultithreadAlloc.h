@@ -0,0 +1,388 @@
+#pragma once
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <vector>
+#include "ThreadLocalDynamic.h"
+#include "../StampedAllocator/StampedAllocator.h"
+#include "../StampedAllocator/alloc_stats.h"
+
+/*
+    The allocator of sketch.md.
+
+    Every thread allocates from and frees to a free list of its own
+    (thread_pool), with no synchronization at all. What a thread cannot
+    serve itself comes from the two allocators all threads share:
+
+    central_pool    the mediator. A thread whose free list grows to
+                    2 * Batch blocks hands Batch of them over in one piece;
+                    a thread whose list runs dry takes one such batch back.
+                    So blocks flow from the threads that free (consumers)
+                    to the threads that allocate (producers), a lock per
+                    Batch blocks, and nobody is handed more than Batch at
+                    a time.
+    principal       the backup when the central pool is empty as well:
+                    fresh blocks carved from slabs. It never takes a block
+                    back; the memory goes to the base allocator when the
+                    MultithreadAlloc does.
+
+    FailureAllocator puts a thread's pool (the default) in front of the
+    principal (the backup). Batch = 0 turns the hand-off off and leaves
+    plain thread-local free lists: with producers and consumers on
+    different threads, every freed block then piles up on a consumer that
+    never allocates, and every allocation is a fresh block.
+
+    The pools are owned by the MultithreadAlloc, which keeps the registry of
+    them, and not by their threads: a thread that exits leaves the (fewer
+    than 2 * Batch) blocks on its list parked there until the end.
+
+    Blocks are StampedRefs, and the stamp goes up on every reuse as in
+    SlabStampedAllocator. A free block holds the ref of the next one, so
+    the principal must hand out blocks with room for a ref;
+    SlabStampedAllocator's have.
+*/
+namespace sidney3
+{
+template<
+    typename BackupAllocator,
+    typename DefaultAllocator,
+    typename Stats = alloc_stats::none>
+struct FailureAllocator : DefaultAllocator
+{
+    using pointer = std::allocator_traits<BackupAllocator>::pointer;
+    static_assert(std::is_same_v<
+            pointer,
+            typename std::allocator_traits<DefaultAllocator>::pointer>);
+
+    // args go to the DefaultAllocator
+    template<typename ... Args>
+    explicit FailureAllocator(BackupAllocator *failureAlloc, Args&&... args)
+        : DefaultAllocator(std::forward<Args>(args)...), failureAlloc_{failureAlloc}
+    {}
+
+    pointer allocate(const size_t count)
+    {
+        pointer _ptr = DefaultAllocator::allocate(count);
+
+        if(_ptr == nullptr)
+        {
+            _ptr = failureAlloc_->allocate(count);
+            assert(!(_ptr == nullptr)
+                    && "Backup allocator must succeed at allocation");
+            // handed straight out, nothing of it stays here
+            stats_.base_call(0);
+        }
+
+        return _ptr;
+    }
+
+    void deallocate(pointer ptr, size_t count)
+    {
+        if(!DefaultAllocator::deallocate(ptr, count))
+        {
+            bool backupSuccess = failureAlloc_->deallocate(ptr, count);
+            assert(backupSuccess
+                    && "backup allocator must succeed at deallocation");
+        }
+    }
+
+    alloc_stats::totals stats() const
+    {
+        return stats_.snapshot();
+    }
+
+    ~FailureAllocator()
+    {
+        stats_.dump("FailureAllocator");
+    }
+
+
+private:
+    BackupAllocator *failureAlloc_;
+    [[no_unique_address]] Stats stats_;
+};
+
+/*
+    The principal: a SlabStampedAllocator behind a lock. deallocate refuses
+    everything, blocks only go back when the allocator does.
+*/
+template<
+    typename T,
+    typename StampedRef = StampedRefNormal<T>,
+    typename BaseAllocator = std::allocator<T>,
+    size_t SlabObjects = 256,
+    typename Stats = alloc_stats::none>
+struct principal_slabs
+{
+    using value_type = T;
+    using pointer = StampedRef;
+
+    pointer allocate(size_t count)
+    {
+        assert(count == 1);
+        std::lock_guard<std::mutex> lock{mtx_};
+        ++carved_;
+        return slabs_.allocate();
+    }
+
+    bool deallocate(pointer, size_t)
+    {
+        return false;
+    }
+
+    // every block handed out so far, i.e. every block there is
+    size_t carved() const
+    {
+        std::lock_guard<std::mutex> lock{mtx_};
+        return carved_;
+    }
+
+    alloc_stats::totals stats() const
+    {
+        std::lock_guard<std::mutex> lock{mtx_};
+        return slabs_.stats();
+    }
+
+private:
+    mutable std::mutex mtx_;
+    SlabStampedAllocator<T, StampedRef, BaseAllocator, SlabObjects, Stats> slabs_;
+    size_t carved_ = 0;
+};
+
+/*
+    The mediator: batches of free blocks, each a list linked through the
+    blocks themselves, so handing one over is a push or a pop under the
+    lock. take() looks at the count before locking, so that the threads
+    that find nothing here do not queue up on the lock for it.
+*/
+template<typename StampedRef>
+struct central_pool
+{
+    struct batch
+    {
+        StampedRef first;
+        size_t count;
+    };
+
+    void give(batch b)
+    {
+        std::lock_guard<std::mutex> lock{mtx_};
+        batches_.push_back(b);
+        blocks_.fetch_add(b.count, std::memory_order_relaxed);
+    }
+
+    std::optional<batch> take()
+    {
+        if(blocks_.load(std::memory_order_relaxed) == 0)
+        {
+            return std::nullopt;
+        }
+        std::lock_guard<std::mutex> lock{mtx_};
+        if(batches_.empty())
+        {
+            return std::nullopt;
+        }
+        batch b = batches_.back();
+        batches_.pop_back();
+        blocks_.fetch_sub(b.count, std::memory_order_relaxed);
+        return b;
+    }
+
+    size_t blocks() const
+    {
+        return blocks_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::mutex mtx_;
+    std::vector<batch> batches_;
+    std::atomic<size_t> blocks_{ 0 };
+};
+
+/*
+    A thread's own free list. allocate gives nullptr when neither the list
+    nor the central pool has a block, for the FailureAllocator to go to the
+    principal; deallocate always keeps the block.
+*/
+template<typename T, typename StampedRef = StampedRefNormal<T>, size_t Batch = 64>
+struct thread_pool
+{
+    using value_type = T;
+    using pointer = StampedRef;
+    using central_type = central_pool<StampedRef>;
+
+    explicit thread_pool(central_type* central)
+        : central_(central)
+    {}
+
+    pointer allocate(size_t count)
+    {
+        assert(count == 1);
+        if constexpr(Batch > 0)
+        {
+            if(head_ == nullptr)
+            {
+                if(auto b = central_->take())
+                {
+                    head_ = b->first;
+                    size_ = b->count;
+                }
+            }
+        }
+        StampedRef ref = head_;
+        if(!(ref == nullptr))
+        {
+            head_ = next(ref);
+            --size_;
+            ref.incStamp();
+        }
+        return ref;
+    }
+
+    bool deallocate(pointer ref, size_t count)
+    {
+        assert(count == 1);
+        new (ref.get_ptr()) StampedRef{head_};
+        head_ = ref;
+        ++size_;
+        if constexpr(Batch > 0)
+        {
+            if(size_ >= 2 * Batch)
+            {
+                hand_off();
+            }
+        }
+        return true;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+private:
+    static StampedRef& next(StampedRef ref)
+    {
+        return *reinterpret_cast<StampedRef*>(ref.get_ptr());
+    }
+
+    // the top Batch blocks go to the central pool, cut off as one list
+    void hand_off()
+    {
+        StampedRef last = head_;
+        for(size_t i = 1; i < Batch; ++i)
+        {
+            last = next(last);
+        }
+        typename central_type::batch b{head_, Batch};
+        head_ = next(last);
+        next(last) = StampedRef{nullptr};
+        size_ -= Batch;
+        central_->give(b);
+    }
+
+    central_type* central_;
+    StampedRef head_{ nullptr };
+    size_t size_ = 0;
+};
+
+template<
+    typename T,
+    typename PrincipleAlloc = principal_slabs<T>,
+    typename ThreadLocalAlloc = thread_pool<T, typename PrincipleAlloc::pointer>,
+    typename Stats = alloc_stats::none
+    >
+struct MultithreadAlloc
+{
+    using value_type = T;
+    using StampedRef = typename PrincipleAlloc::pointer;
+
+    MultithreadAlloc() = default;
+    MultithreadAlloc(const MultithreadAlloc&) = delete;
+    MultithreadAlloc& operator=(const MultithreadAlloc&) = delete;
+
+    template<typename ... Args>
+    [[nodiscard]]
+    StampedRef construct(Args&&... args)
+    {
+        StampedRef ref = allocate();
+        new (ref.get_ptr()) T {std::forward<Args>(args)...};
+        return ref;
+    }
+
+    void free(StampedRef ref)
+    {
+        assert(!(ref == nullptr) && "freeing nullptr");
+        ref->~T();
+        deallocate(ref);
+    }
+
+    [[nodiscard]]
+    StampedRef allocate()
+    {
+        StampedRef ref = local().allocate(1);
+        _stats.allocated();
+        return ref;
+    }
+
+    // from any thread: the block joins the calling thread's list
+    void deallocate(StampedRef ref)
+    {
+        local().deallocate(ref, 1);
+        _stats.freed();
+    }
+
+    const PrincipleAlloc& principal() const
+    {
+        return mainAllocator;
+    }
+
+    const typename ThreadLocalAlloc::central_type& central() const
+    {
+        return central_;
+    }
+
+    alloc_stats::totals stats() const
+    {
+        return _stats.snapshot();
+    }
+
+    ~MultithreadAlloc()
+    {
+        _stats.dump("MultithreadAlloc");
+    }
+
+private:
+    using local_type = FailureAllocator<PrincipleAlloc, ThreadLocalAlloc>;
+
+    local_type& local()
+    {
+        if(local_type** mine = threadLocalAllocator.find())
+        {
+            return **mine;
+        }
+        std::lock_guard<std::mutex> lock{registryMtx_};
+        pools_.push_back(std::make_unique<local_type>(&mainAllocator, &central_));
+        threadLocalAllocator.store(pools_.back().get());
+        return *pools_.back();
+    }
+
+    PrincipleAlloc mainAllocator;
+    typename ThreadLocalAlloc::central_type central_;
+    std::mutex registryMtx_;
+    std::vector<std::unique_ptr<local_type>> pools_;
+    ThreadLocal<
+        MultithreadAlloc, local_type*
+        > threadLocalAllocator;
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+    [[no_unique_address]]
+    Stats _stats;
+#else
+    Stats _stats;
+#endif
+};
+
+} // namespace sidney3
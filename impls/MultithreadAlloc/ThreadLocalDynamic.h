@@ -1,53 +1,85 @@
-#include <unordered_map>
-#include <thread>
-#include <iostream>
+#pragma once
+#include <atomic>
 #include <cassert>
-#include <type_traits>
+#include <cstdint>
+#include <unordered_map>
+
+/*
+    A T per (ThreadLocal, thread): each thread that touches the variable
+    sees a copy of its own.
 
-#define INIT_THREAD_LOCAL(class_type, object_type) \
-    template<> \
-    thread_local std::unordered_map<std::add_pointer_t<class_type>, object_type> ThreadLocal<class_type, object_type>::_map{};
+    Entries are keyed by an id no other ThreadLocal ever gets, not by
+    address, so a thread that outlives one variable cannot find its entry
+    again under a new one built at the same place. The destructor can only
+    reach the calling thread's entry; every other thread keeps its copy
+    until it exits, so T should not own anything that dies with the
+    variable (a pointer into the container is fine).
 
+    The last lookup is cached per thread, which makes the common case of
+    one variable used over and over a compare and a load.
+*/
 template<typename Container, typename T>
 struct ThreadLocal
 {
-    ThreadLocal(Container* self, T init)
-      : self(self)
+    ThreadLocal() = default;
+    explicit ThreadLocal(T init)
     {
-        _map.insert({self, init});
+        store(init);
     }
-    ThreadLocal(Container* self)
-      : self(self)
-    {}
+    ThreadLocal(const ThreadLocal&) = delete;
+    ThreadLocal& operator=(const ThreadLocal&) = delete;
 
     void store(T object)
     {
-        auto it = _map.find(self);
-
-        if(it == _map.end())
-        {
-            _map.insert({self, object});
-        }
-        else
-        {
-            it->second = object;
-        }
+        T& slot = _map[id];
+        slot = object;
+        cache_ = {id, &slot};
     }
 
     T &load()
     {
-        auto it = _map.find(self);
-        assert(it != _map.end()
+        T* res = find();
+        assert(res != nullptr
             && "variable must be initialized");
 
-        return it->second;
+        return *res;
+    }
+
+    // nullptr when this thread has not stored anything yet
+    T* find()
+    {
+        if(cache_.id == id)
+        {
+            return cache_.object;
+        }
+        auto it = _map.find(id);
+        if(it == _map.end())
+        {
+            return nullptr;
+        }
+        cache_ = {id, &it->second};
+        return &it->second;
     }
 
     ~ThreadLocal()
     {
-        _map.erase(self);
+        if(cache_.id == id)
+        {
+            cache_ = {};
+        }
+        _map.erase(id);
     }
 private:
-    Container* self;
-    static thread_local std::unordered_map<Container*, T> _map;
+    struct cached
+    {
+        uint64_t id = 0;
+        T* object = nullptr;
+    };
+
+    // 0 is never handed out, so an empty cache matches no one
+    static inline std::atomic<uint64_t> next_id{ 1 };
+    const uint64_t id = next_id.fetch_add(1, std::memory_order_relaxed);
+
+    static inline thread_local std::unordered_map<uint64_t, T> _map;
+    static inline thread_local cached cache_;
 };
@@ -6,20 +6,32 @@
 #include <cassert>
 #include <atomic>
 #include <optional>
+#include <memory>
+#include <cstddef>
+#include <algorithm>
+#include "alloc_stats.h"
 
 /*
     The more efficient implementation of a stamped reference: for a type T we store only 
     a T* value and use the bits that we know will be 0 (for alignment reasons) to store
     the stamp.
 
+    Align is the alignment the pointers are known to have, alignof(T) when left at 0. The
+    allocators below align what they hand out to StampedRef::alignment(), so with
+    StampedRefStealing<Node, 64> as their ref every node starts its own cache line and the
+    ref gets 6 bits of stamp however small Node is.
+
     Note that in order to allow incomplete types T, we make direct reference to T outside of methods
 */
-template<typename T>
+template<typename T, size_t Align = 0>
 struct alignas(sizeof(uintptr_t)) StampedRefStealing
 {
+    static_assert((Align & (Align - 1)) == 0, "Align must be a power of two");
+
     constexpr StampedRefStealing(T* ptr, const size_t init_stamp = 0)
         : _ptr(reinterpret_cast<uintptr_t>(ptr))
     {
+        assert(!(_ptr & mask()) && "pointer not aligned to Align");
         setStamp(init_stamp);
     }
     constexpr void setStamp(size_t new_stamp)
@@ -56,6 +68,16 @@ struct alignas(sizeof(uintptr_t)) StampedRefStealing
     {
         return reinterpret_cast<T*>(_ptr & ~mask());
     }
+    // what the pointers are aligned to, so what an allocator has to align to
+    static constexpr size_t alignment()
+    {
+        static_assert(Align == 0 || Align >= alignof(T));
+        return Align == 0 ? alignof(T) : Align;
+    }
+    static constexpr size_t max_stamp()
+    {
+        return mask();
+    }
 private:
     void testStamp(size_t new_stamp)
     {
@@ -74,11 +96,7 @@ private:
     }
     static constexpr uintptr_t mask()
     {
-        return std::alignment_of_v<T> - 1;
-    }
-    static constexpr size_t max_stamp()
-    {
-        return mask();
+        return alignment() - 1;
     }
     uintptr_t _ptr;
 };
@@ -132,6 +150,10 @@ struct alignas(2*sizeof(uintptr_t)) StampedRefNormal
     {
         return rhs == get_ptr();
     }
+    static constexpr size_t alignment()
+    {
+        return alignof(T);
+    }
 
 private:
     uintptr_t _ptr;
@@ -181,7 +203,8 @@ private:
 template<
     typename T,
     typename StampedRef = StampedRefNormal<T>,
-    typename BaseAllocator = std::allocator<T>
+    typename BaseAllocator = std::allocator<T>,
+    typename Stats = alloc_stats::none
     >
 struct StampedAllocator
 {
@@ -193,8 +216,10 @@ struct StampedAllocator
     {
         if(freeList.empty())
         {
-            T* baseRef = std::allocator_traits<BaseAllocator>::allocate(_alloc, 1);
+            T* baseRef = reinterpret_cast<T*>(BlockTraits::allocate(_alloc, 1));
             new (&baseRef[0]) T {std::forward<Args>(args)...};
+            _stats.base_call();
+            _stats.allocated();
             return StampedRef{baseRef};
         }
         else
@@ -202,6 +227,11 @@ struct StampedAllocator
             StampedRef freeNode = *freeList.pop();
             new (freeNode.get_ptr()) T {std::forward<Args>(args)...};
             freeNode.incStamp();
+            if(freeNode.getStamp() == 0)
+            {
+                _stats.stamp_wrap();
+            }
+            _stats.allocated();
             return freeNode;
         }
     }
@@ -212,25 +242,179 @@ struct StampedAllocator
                 && "freeing nullptr");
         ref->~T();
         freeList.push(std::move(ref));
+        _stats.freed();
+    }
+
+    alloc_stats::totals stats() const
+    {
+        return _stats.snapshot();
     }
 
     ~StampedAllocator()
     {
+        _stats.dump("StampedAllocator");
         while(!freeList.empty())
         {
             StampedRef top = *freeList.pop();
-            std::allocator_traits<BaseAllocator>::deallocate(_alloc, top.get_ptr(), 1);
+            BlockTraits::deallocate(_alloc, reinterpret_cast<block*>(top.get_ptr()), 1);
 
         }
     }
 
 private:
+    struct alignas(StampedRef::alignment()) block
+    {
+        std::byte storage[sizeof(T)];
+    };
+    using BlockAllocator = typename std::allocator_traits<BaseAllocator>::template rebind_alloc<block>;
+    using BlockTraits = std::allocator_traits<BlockAllocator>;
+
 #if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
     [[no_unique_address]]
-    BaseAllocator _alloc;
+    BlockAllocator _alloc;
 #else
-    BaseAllocator _alloc;
+    BlockAllocator _alloc;
 #endif
     FreeList<StampedRef> freeList;
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+    [[no_unique_address]]
+    Stats _stats;
+#else
+    Stats _stats;
+#endif
 };
 
+/*
+    StampedAllocator carved out of slabs.
+
+    Objects come out of slabs of SlabObjects blocks, handed out in address
+    order, so objects allocated together sit together in memory. A freed
+    block keeps the ref of the next free block in its own storage, which makes
+    the free list intrusive: free and reuse never call the base allocator,
+    only growing does (one slab, plus the odd growth of the slab vector).
+
+    The stamp lives in the ref, as before. free pushes the ref it was given,
+    stamp and all, and construct bumps it on the way out, so a ref to the
+    previous life of a block never compares equal to the current one.
+    allocate / deallocate are the same without constructing or destroying
+    the T, for callers that want raw blocks.
+
+    Slabs go back to the base allocator when the allocator is destroyed.
+*/
+template<
+    typename T,
+    typename StampedRef = StampedRefNormal<T>,
+    typename BaseAllocator = std::allocator<T>,
+    size_t SlabObjects = 256,
+    typename Stats = alloc_stats::none
+    >
+struct SlabStampedAllocator
+{
+    static_assert(SlabObjects > 0);
+    static_assert(std::is_trivially_copyable_v<StampedRef>);
+
+    using value_type = T;
+
+    SlabStampedAllocator() = default;
+    explicit SlabStampedAllocator(const BaseAllocator& alloc)
+        : _alloc(alloc)
+    {}
+    SlabStampedAllocator(const SlabStampedAllocator&) = delete;
+    SlabStampedAllocator& operator=(const SlabStampedAllocator&) = delete;
+
+    template<typename ... Args>
+    [[nodiscard]]
+    StampedRef construct(Args&&... args)
+    {
+        StampedRef ref = allocate();
+        new (ref.get_ptr()) T {std::forward<Args>(args)...};
+        return ref;
+    }
+
+    void free(StampedRef ref)
+    {
+        assert(!(ref == nullptr) && "freeing nullptr");
+        ref->~T();
+        deallocate(ref);
+    }
+
+    [[nodiscard]]
+    StampedRef allocate()
+    {
+        StampedRef ref = freeHead;
+        if(ref == nullptr)
+        {
+            ref = StampedRef{carve()};
+        }
+        else
+        {
+            freeHead = *reinterpret_cast<StampedRef*>(ref.get_ptr());
+            ref.incStamp();
+            if(ref.getStamp() == 0)
+            {
+                _stats.stamp_wrap();
+            }
+        }
+        _stats.allocated();
+        return ref;
+    }
+
+    void deallocate(StampedRef ref)
+    {
+        new (ref.get_ptr()) StampedRef{freeHead};
+        freeHead = ref;
+        _stats.freed();
+    }
+
+    alloc_stats::totals stats() const
+    {
+        return _stats.snapshot();
+    }
+
+    ~SlabStampedAllocator()
+    {
+        _stats.dump("SlabStampedAllocator");
+        for(block* slab : slabs)
+        {
+            BlockTraits::deallocate(_alloc, slab, SlabObjects);
+        }
+    }
+
+private:
+    // room for a T while live, for the next free ref while free
+    struct alignas(std::max(StampedRef::alignment(), alignof(StampedRef))) block
+    {
+        std::byte storage[std::max(sizeof(T), sizeof(StampedRef))];
+    };
+    using BlockAllocator = typename std::allocator_traits<BaseAllocator>::template rebind_alloc<block>;
+    using BlockTraits = std::allocator_traits<BlockAllocator>;
+
+    T* carve()
+    {
+        if(next == end)
+        {
+            slabs.push_back(BlockTraits::allocate(_alloc, SlabObjects));
+            _stats.base_call(SlabObjects);
+            next = slabs.back();
+            end = next + SlabObjects;
+        }
+        return reinterpret_cast<T*>(next++);
+    }
+
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+    [[no_unique_address]]
+    BlockAllocator _alloc;
+#else
+    BlockAllocator _alloc;
+#endif
+    StampedRef freeHead{ nullptr };
+    block* next = nullptr;
+    block* end = nullptr;
+    std::vector<block*> slabs;
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+    [[no_unique_address]]
+    Stats _stats;
+#else
+    Stats _stats;
+#endif
+};
@@ -0,0 +1,264 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <format>
+#include <iostream>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+/*
+    Optional allocator statistics.
+
+    The allocators take a Stats parameter, alloc_stats::none by default: every
+    hook is an empty inline function and the member takes no space. With
+    alloc_stats::counters they keep
+
+        live            objects handed out and not yet returned
+        high_watermark  the most that were ever live at once
+        free_list       blocks the allocator holds but has not handed out
+        base_calls      calls into the base allocator (for slabs, one per slab)
+        cross_thread    frees from a thread other than the one that allocated
+        stamp_wraps     stamps that wrapped round to 0 on reuse
+
+    and print them when the allocator is destroyed; snapshot() reads them at
+    any time.
+
+    The counters are sharded, one cache line per thread. thread_index() is
+    small and dense (a thread that exits gives its index back), and the
+    thread with index i < Shards is the only writer of shard i: it updates its
+    counters with a relaxed load and store, no lock prefix, so counting costs
+    a few plain instructions on a line nobody else writes. Any threads beyond
+    Shards share one overflow shard and fetch_add into it. snapshot() sums the
+    shards. The free list is not counted at all: base_call says how many
+    blocks each call brought in, and free_list is what of those is not live.
+
+    live is the one counter a watermark needs in one place. Each shard keeps
+    its live count as a pending delta and folds it into the shared count (and
+    the watermark) once it reaches Batch either way, so the shared line is
+    touched once every Batch operations. The watermark can thus miss a peak
+    by less than Shards * Batch; with one thread it is off by less than Batch.
+*/
+namespace alloc_stats
+{
+struct totals
+{
+    int64_t live = 0;
+    int64_t high_watermark = 0;
+    int64_t free_list = 0;
+    uint64_t base_calls = 0;
+    uint64_t cross_thread = 0;
+    uint64_t stamp_wraps = 0;
+};
+
+inline void dump(std::string_view name, const totals& t)
+{
+    std::cout << std::format("{}: {} live (high watermark {}), {} on the free list, {} base allocator calls, "
+            "{} cross-thread frees, {} stamp wrap-arounds\n",
+            name, t.live, t.high_watermark, t.free_list, t.base_calls, t.cross_thread, t.stamp_wraps);
+}
+
+namespace detail
+{
+// indices of threads that have exited, for the next threads to take
+struct index_pool
+{
+    size_t take()
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        if(returned.empty())
+        {
+            return next++;
+        }
+        size_t i = returned.back();
+        returned.pop_back();
+        return i;
+    }
+    void give(size_t i)
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        returned.push_back(i);
+    }
+
+    static index_pool& instance()
+    {
+        // never destroyed: threads may still exit after static destructors ran
+        static index_pool* pool = new index_pool;
+        return *pool;
+    }
+
+private:
+    std::mutex mtx;
+    std::vector<size_t> returned;
+    size_t next = 0;
+};
+
+struct thread_slot
+{
+    const size_t index = index_pool::instance().take();
+    ~thread_slot()
+    {
+        index_pool::instance().give(index);
+    }
+};
+}
+
+// unique among the threads alive, and as small as it can be
+inline size_t thread_index()
+{
+    static thread_local detail::thread_slot slot;
+    return slot.index;
+}
+
+// unique among all threads ever, for telling who allocated a block
+inline uint64_t thread_serial()
+{
+    static std::atomic<uint64_t> next{ 0 };
+    static thread_local const uint64_t me = next.fetch_add(1, std::memory_order_relaxed);
+    return me;
+}
+
+struct none
+{
+    static constexpr bool enabled = false;
+
+    void allocated() {}
+    void freed() {}
+    void base_call(int64_t = 1) {}
+    void cross_thread() {}
+    void stamp_wrap() {}
+
+    totals snapshot() const
+    {
+        return {};
+    }
+    void dump(std::string_view) const {}
+};
+
+template<size_t Shards = 64, int64_t Batch = 32>
+struct counters
+{
+    static_assert(Shards > 0 && Batch > 0);
+    static constexpr bool enabled = true;
+
+    void allocated()
+    {
+        handle h = mine();
+        if(h.add(h.s.pending, 1) >= Batch)
+        {
+            fold(h);
+        }
+    }
+    void freed()
+    {
+        handle h = mine();
+        if(h.add(h.s.pending, -1) <= -Batch)
+        {
+            fold(h);
+        }
+    }
+    // blocks: how many blocks the call brought in
+    void base_call(int64_t blocks = 1)
+    {
+        handle h = mine();
+        h.add(h.s.base_calls, 1);
+        h.add(h.s.blocks, blocks);
+    }
+    void cross_thread()
+    {
+        handle h = mine();
+        h.add(h.s.cross_thread, 1);
+    }
+    void stamp_wrap()
+    {
+        handle h = mine();
+        h.add(h.s.stamp_wraps, 1);
+    }
+
+    totals snapshot() const
+    {
+        totals t;
+        t.live = live_.load(std::memory_order_relaxed);
+        auto sum = [&t](const shard& s){
+            t.live += s.pending.load(std::memory_order_relaxed);
+            t.free_list += s.blocks.load(std::memory_order_relaxed);
+            t.base_calls += s.base_calls.load(std::memory_order_relaxed);
+            t.cross_thread += s.cross_thread.load(std::memory_order_relaxed);
+            t.stamp_wraps += s.stamp_wraps.load(std::memory_order_relaxed);
+        };
+        for(const shard& s : shards_)
+        {
+            sum(s);
+        }
+        sum(overflow_);
+        t.free_list -= t.live;
+        t.high_watermark = std::max(t.live, peak_.load(std::memory_order_relaxed));
+        return t;
+    }
+    void dump(std::string_view name) const
+    {
+        alloc_stats::dump(name, snapshot());
+    }
+
+private:
+    static constexpr size_t cacheLineSize = 64;
+
+    struct alignas(cacheLineSize) shard
+    {
+        std::atomic<int64_t> pending{ 0 };
+        std::atomic<int64_t> blocks{ 0 };
+        std::atomic<uint64_t> base_calls{ 0 };
+        std::atomic<uint64_t> cross_thread{ 0 };
+        std::atomic<uint64_t> stamp_wraps{ 0 };
+    };
+
+    struct handle
+    {
+        shard& s;
+        bool exclusive;
+
+        // returns the new value
+        template<typename U>
+        U add(std::atomic<U>& counter, int64_t delta) const
+        {
+            if(exclusive)
+            {
+                U value = counter.load(std::memory_order_relaxed) + delta;
+                counter.store(value, std::memory_order_relaxed);
+                return value;
+            }
+            return counter.fetch_add(delta, std::memory_order_relaxed) + delta;
+        }
+    };
+
+    handle mine()
+    {
+        const size_t i = thread_index();
+        return i < Shards ? handle{shards_[i], true} : handle{overflow_, false};
+    }
+
+    void fold(handle h)
+    {
+        int64_t delta;
+        if(h.exclusive)
+        {
+            delta = h.s.pending.load(std::memory_order_relaxed);
+            h.s.pending.store(0, std::memory_order_relaxed);
+        }
+        else
+        {
+            delta = h.s.pending.exchange(0, std::memory_order_relaxed);
+        }
+        const int64_t now = live_.fetch_add(delta, std::memory_order_relaxed) + delta;
+        int64_t peak = peak_.load(std::memory_order_relaxed);
+        while(now > peak && !peak_.compare_exchange_weak(peak, now, std::memory_order_relaxed));
+    }
+
+    std::array<shard, Shards> shards_;
+    shard overflow_;
+    alignas(cacheLineSize) std::atomic<int64_t> live_{ 0 };
+    std::atomic<int64_t> peak_{ 0 };
+};
+}
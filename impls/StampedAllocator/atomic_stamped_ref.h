@@ -0,0 +1,234 @@
+#pragma once
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include "StampedAllocator.h"
+
+/*
+    Stamped references whose atomics never take a lock.
+
+    std::atomic<StampedRefNormal<T>> is 16 bytes, and GCC hands 16 byte
+    atomics to libatomic, which is free to use a lock (and reports
+    is_lock_free() == false even when it doesn't). Two ways out:
+
+    StampedRefPacked: 8 bytes. User space pointers on x86-64 and aarch64 Linux
+        fit in the low 48 bits, so the top 16 bits are free; together with the
+        alignment bits at the bottom (as in StampedRefStealing) they hold the
+        stamp. 16 + log2(alignof(T)) bits of stamp, and std::atomic of it is a
+        plain 64 bit CAS.
+
+    atomic_stamped_ref<Ref>: drop-in for std::atomic<Ref> that picks how to do
+        it at compile time (see mode below):
+
+        native:     std::atomic<Ref> is always lock-free already (8 byte refs)
+        cmpxchg16b: 16 byte refs on x86-64, by inline lock cmpxchg16b - loads
+                    included, as a CAS of the current value with itself
+        libatomic:  anything else, std::atomic<Ref> as it is; may block
+
+    The memory order arguments are accepted for compatibility; lock cmpxchg16b
+    is a full barrier regardless. ThreadSanitizer cannot see into the asm, so
+    under -fsanitize=thread 16 byte refs go back to libatomic.
+*/
+template<typename T>
+struct alignas(sizeof(uintptr_t)) StampedRefPacked
+{
+    StampedRefPacked(T* ptr, const size_t init_stamp = 0)
+        : _ptr(reinterpret_cast<uintptr_t>(ptr))
+    {
+        assert(!(_ptr & ~ptr_mask()) && "pointer does not fit in 48 bits or is misaligned");
+        setStamp(init_stamp);
+    }
+    constexpr void setStamp(size_t new_stamp)
+    {
+        assert(new_stamp <= max_stamp());
+        _ptr = (_ptr & ptr_mask())
+            | (new_stamp & low_mask())
+            | static_cast<uintptr_t>(new_stamp >> low_bits()) << address_bits;
+    }
+    constexpr size_t getStamp() const
+    {
+        return (_ptr & low_mask()) | (_ptr >> address_bits) << low_bits();
+    }
+    void incStamp()
+    {
+        setStamp(getStamp() == max_stamp() ? 0 : getStamp() + 1);
+    }
+
+    T* operator->()
+    {
+        return get_ptr();
+    }
+    T& operator*()
+    {
+        return *get_ptr();
+    }
+
+    bool operator==(const T* rhs)
+    {
+        return get_ptr() == rhs;
+    }
+    T* get_ptr()
+    {
+        return reinterpret_cast<T*>(_ptr & ptr_mask());
+    }
+
+    static constexpr size_t max_stamp()
+    {
+        return (size_t{1} << (64 - address_bits + low_bits())) - 1;
+    }
+    static constexpr size_t alignment()
+    {
+        return alignof(T);
+    }
+
+private:
+    static constexpr int address_bits = 48;
+
+    static constexpr uintptr_t low_mask()
+    {
+        return std::alignment_of_v<T> - 1;
+    }
+    static constexpr int low_bits()
+    {
+        return __builtin_ctzll(std::alignment_of_v<T>);
+    }
+    static constexpr uintptr_t ptr_mask()
+    {
+        return ((uintptr_t{1} << address_bits) - 1) & ~low_mask();
+    }
+    uintptr_t _ptr;
+};
+
+enum class stamped_atomic_mode
+{
+    native,
+    cmpxchg16b,
+    libatomic,
+};
+
+constexpr std::string_view mode_name(stamped_atomic_mode mode)
+{
+    switch(mode)
+    {
+    case stamped_atomic_mode::native:
+        return "native";
+    case stamped_atomic_mode::cmpxchg16b:
+        return "cmpxchg16b";
+    default:
+        return "libatomic";
+    }
+}
+
+template<typename Ref>
+constexpr stamped_atomic_mode mode_for()
+{
+    if constexpr(std::atomic<Ref>::is_always_lock_free)
+    {
+        return stamped_atomic_mode::native;
+    }
+#if defined(__x86_64__) && !defined(__SANITIZE_THREAD__)
+    else if constexpr(sizeof(Ref) == 16 && alignof(Ref) == 16 && std::is_trivially_copyable_v<Ref>)
+    {
+        return stamped_atomic_mode::cmpxchg16b;
+    }
+#endif
+    else
+    {
+        return stamped_atomic_mode::libatomic;
+    }
+}
+
+template<typename Ref, stamped_atomic_mode Mode = mode_for<Ref>()>
+struct atomic_stamped_ref : std::atomic<Ref>
+{
+    static constexpr stamped_atomic_mode mode = Mode;
+    static constexpr bool is_always_lock_free = Mode == stamped_atomic_mode::native;
+
+    using std::atomic<Ref>::atomic;
+    using std::atomic<Ref>::operator=;
+};
+
+#if defined(__x86_64__)
+template<typename Ref>
+struct atomic_stamped_ref<Ref, stamped_atomic_mode::cmpxchg16b>
+{
+    static constexpr stamped_atomic_mode mode = stamped_atomic_mode::cmpxchg16b;
+    static constexpr bool is_always_lock_free = true;
+
+    atomic_stamped_ref(Ref init)
+        : raw_(to_raw(init))
+    {}
+    atomic_stamped_ref(const atomic_stamped_ref&) = delete;
+    atomic_stamped_ref& operator=(const atomic_stamped_ref&) = delete;
+
+    Ref load(std::memory_order = std::memory_order_seq_cst) const
+    {
+        // fails unless raw_ happens to be zero, and either way hands back its value
+        unsigned __int128 current = 0;
+        cas(current, 0);
+        return from_raw(current);
+    }
+    void store(Ref desired, std::memory_order order = std::memory_order_seq_cst)
+    {
+        exchange(desired, order);
+    }
+    Ref exchange(Ref desired, std::memory_order = std::memory_order_seq_cst)
+    {
+        unsigned __int128 current = to_raw(load());
+        while(!cas(current, to_raw(desired)));
+        return from_raw(current);
+    }
+    bool compare_exchange_strong(Ref& expected, Ref desired,
+            std::memory_order = std::memory_order_seq_cst, std::memory_order = std::memory_order_seq_cst)
+    {
+        unsigned __int128 e = to_raw(expected);
+        bool ok = cas(e, to_raw(desired));
+        expected = from_raw(e);
+        return ok;
+    }
+    bool compare_exchange_weak(Ref& expected, Ref desired,
+            std::memory_order success = std::memory_order_seq_cst,
+            std::memory_order failure = std::memory_order_seq_cst)
+    {
+        return compare_exchange_strong(expected, desired, success, failure);
+    }
+    operator Ref() const
+    {
+        return load();
+    }
+    bool is_lock_free() const
+    {
+        return true;
+    }
+
+private:
+    static unsigned __int128 to_raw(Ref r)
+    {
+        return std::bit_cast<unsigned __int128>(r);
+    }
+    static Ref from_raw(unsigned __int128 raw)
+    {
+        return std::bit_cast<Ref>(raw);
+    }
+
+    // on failure expected becomes the current value
+    bool cas(unsigned __int128& expected, unsigned __int128 desired) const
+    {
+        uint64_t lo = static_cast<uint64_t>(expected);
+        uint64_t hi = static_cast<uint64_t>(expected >> 64);
+        bool ok;
+        asm volatile("lock cmpxchg16b %1"
+                : "=@ccz"(ok), "+m"(raw_), "+a"(lo), "+d"(hi)
+                : "b"(static_cast<uint64_t>(desired)), "c"(static_cast<uint64_t>(desired >> 64))
+                : "memory");
+        expected = static_cast<unsigned __int128>(hi) << 64 | lo;
+        return ok;
+    }
+
+    // load() CASes too, so even a const view writes
+    alignas(16) mutable unsigned __int128 raw_;
+};
+#endif
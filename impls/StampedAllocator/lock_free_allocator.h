@@ -0,0 +1,230 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include "StampedAllocator.h"
+#include "atomic_stamped_ref.h"
+#include "alloc_stats.h"
+#include "../backoff/backoff.h"
+
+/*
+    Lock-free StampedAllocator: allocate and deallocate from any thread, no
+    mutex. Same interface as ThreadSafeAllocator, so it drops into
+    lock_free_stack as its Allocator.
+
+    The free list is a Treiber stack of the free blocks themselves, and its
+    head is the stamped ref of the top block. deallocate bumps the stamp of
+    the ref it is given (as every StampedAllocator does, for the sake of
+    whoever uses the refs) before pushing it, so a block that leaves the list
+    and comes back comes back under a new stamp. The stamps that protect the
+    user's structure from ABA thus protect the free list too: a pop that read
+    head and then stalled fails its CAS if the block went round in between.
+
+    Each block keeps the ref of the block below it next to the T (not inside
+    it), in relaxed atomic words; while the block is out the same words hold
+    its own ref, so deallocate(T*) can recover the stamp from a bare pointer.
+    A pop may read next just as the block is popped, reused and freed again by
+    someone else; the words can then tear, but the stamp on head has moved on
+    too, so the CAS that would use them fails. Likewise the T storage of a
+    free block may still be read by a stalled user of the structure, so blocks
+    never go back to the base allocator before the allocator itself is
+    destroyed.
+
+    Blocks are aligned to StampedRef::alignment(): over-aligned refs such as
+    StampedRefStealing<T, 64> get one cache line per block, and 6 bits of
+    stamp in an 8 byte head.
+
+    An empty list grows by a slab of SlabObjects blocks: one goes to the
+    caller, the rest go onto the list with one CAS. BaseAllocator must be
+    safe to call from several threads at once (std::allocator is).
+*/
+template<
+    typename T,
+    typename StampedRef = StampedRefNormal<T>,
+    typename BaseAllocator = std::allocator<T>,
+    typename Backoff = backoff::tiered<>,
+    size_t SlabObjects = 64,
+    typename Stats = alloc_stats::none
+    >
+struct LockFreeStampedAllocator
+{
+    static_assert(SlabObjects > 0);
+    static_assert(std::is_trivially_copyable_v<StampedRef>);
+    static_assert(sizeof(StampedRef) % sizeof(uintptr_t) == 0);
+
+    using value_type = T;
+
+    LockFreeStampedAllocator() = default;
+    explicit LockFreeStampedAllocator(const BaseAllocator& alloc)
+        : _alloc(alloc)
+    {}
+    LockFreeStampedAllocator(const LockFreeStampedAllocator&) = delete;
+    LockFreeStampedAllocator& operator=(const LockFreeStampedAllocator&) = delete;
+
+    [[nodiscard]]
+    StampedRef allocate()
+    {
+        StampedRef top = head.load(std::memory_order_acquire);
+        for(Backoff backoff; !(top == nullptr); backoff())
+        {
+            if(head.compare_exchange_weak(top, next_of(top), std::memory_order_acquire, std::memory_order_acquire))
+            {
+                return handed_out(top);
+            }
+        }
+        return handed_out(grow());
+    }
+
+    void deallocate(StampedRef ref)
+    {
+        assert(!(ref == nullptr) && "freeing nullptr");
+        if constexpr(Stats::enabled)
+        {
+            if(block_of(ref)->owner.load(std::memory_order_relaxed) != alloc_stats::thread_serial())
+            {
+                _stats.cross_thread();
+            }
+            _stats.freed();
+        }
+        ref.incStamp();
+        if(ref.getStamp() == 0)
+        {
+            _stats.stamp_wrap();
+        }
+        push(ref, ref);
+    }
+
+    // for callers that kept only the pointer: the block remembers its ref
+    void deallocate(T* ptr)
+    {
+        deallocate(next_of(StampedRef{ptr}));
+    }
+
+    alloc_stats::totals stats() const
+    {
+        return _stats.snapshot();
+    }
+
+    ~LockFreeStampedAllocator()
+    {
+        _stats.dump("LockFreeStampedAllocator");
+        for(slab* s = slabs.load(); s != nullptr; )
+        {
+            slab* next = s->next;
+            SlabTraits::deallocate(_alloc, s, 1);
+            s = next;
+        }
+    }
+
+private:
+    static constexpr size_t ref_words = sizeof(StampedRef) / sizeof(uintptr_t);
+    using words = std::array<uintptr_t, ref_words>;
+
+    struct no_owner {};
+    using owner_word = std::conditional_t<Stats::enabled, std::atomic<uint64_t>, no_owner>;
+
+    // T first, so a T* is a block*
+    struct block
+    {
+        alignas(StampedRef::alignment()) std::byte storage[sizeof(T)];
+        std::atomic<uintptr_t> next[ref_words];
+        [[no_unique_address]] owner_word owner;
+    };
+    struct slab
+    {
+        block blocks[SlabObjects];
+        slab* next;
+    };
+    using SlabAllocator = typename std::allocator_traits<BaseAllocator>::template rebind_alloc<slab>;
+    using SlabTraits = std::allocator_traits<SlabAllocator>;
+
+    static block* block_of(StampedRef ref)
+    {
+        return reinterpret_cast<block*>(ref.get_ptr());
+    }
+    static StampedRef next_of(StampedRef ref)
+    {
+        block* b = block_of(ref);
+        words w;
+        for(size_t i = 0; i < ref_words; ++i)
+        {
+            w[i] = b->next[i].load(std::memory_order_relaxed);
+        }
+        return std::bit_cast<StampedRef>(w);
+    }
+    static void set_next(StampedRef ref, StampedRef next)
+    {
+        block* b = block_of(ref);
+        words w = std::bit_cast<words>(next);
+        for(size_t i = 0; i < ref_words; ++i)
+        {
+            b->next[i].store(w[i], std::memory_order_relaxed);
+        }
+    }
+
+    // while a block is out its next words hold its own ref, stamp and all
+    StampedRef handed_out(StampedRef ref)
+    {
+        set_next(ref, ref);
+        if constexpr(Stats::enabled)
+        {
+            block_of(ref)->owner.store(alloc_stats::thread_serial(), std::memory_order_relaxed);
+            _stats.allocated();
+        }
+        return ref;
+    }
+
+    // top ... bottom are linked through next already
+    void push(StampedRef top, StampedRef bottom)
+    {
+        StampedRef old = head.load(std::memory_order_relaxed);
+        for(Backoff backoff; ; backoff())
+        {
+            set_next(bottom, old);
+            if(head.compare_exchange_weak(old, top, std::memory_order_release, std::memory_order_relaxed))
+            {
+                return;
+            }
+        }
+    }
+
+    StampedRef grow()
+    {
+        slab* s = ::new (SlabTraits::allocate(_alloc, 1)) slab;
+        _stats.base_call(SlabObjects);
+        s->next = slabs.load(std::memory_order_relaxed);
+        while(!slabs.compare_exchange_weak(s->next, s, std::memory_order_release, std::memory_order_relaxed));
+
+        if constexpr(SlabObjects > 1)
+        {
+            for(size_t i = 1; i + 1 < SlabObjects; ++i)
+            {
+                set_next(ref_to(s->blocks[i]), ref_to(s->blocks[i + 1]));
+            }
+            push(ref_to(s->blocks[1]), ref_to(s->blocks[SlabObjects - 1]));
+        }
+        return ref_to(s->blocks[0]);
+    }
+    static StampedRef ref_to(block& b)
+    {
+        return StampedRef{reinterpret_cast<T*>(&b)};
+    }
+
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+    [[no_unique_address]]
+    SlabAllocator _alloc;
+#else
+    SlabAllocator _alloc;
+#endif
+    atomic_stamped_ref<StampedRef> head{ nullptr };
+    std::atomic<slab*> slabs{ nullptr };
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+    [[no_unique_address]]
+    Stats _stats;
+#else
+    Stats _stats;
+#endif
+};
@@ -0,0 +1,261 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <memory_resource>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "StampedAllocator.h"
+#include "lock_free_allocator.h"
+
+/*
+    std::pmr::memory_resource over the allocators in this directory, so that
+    standard containers (std::pmr::vector, std::pmr::unordered_map, ...) can
+    draw on them.
+
+    monotonic_arena:    bump allocation out of chunks from upstream, doubling
+                        in size; deallocate does nothing and everything goes
+                        back when the arena does. For containers that only
+                        grow and die together. Not thread safe.
+    unsynchronized_pool: size classes 8, 16, ..., MaxBlock bytes, each a
+                        SlabStampedAllocator: slabs from upstream, freed
+                        blocks on an intrusive free list. One thread at a time.
+    synchronized_pool:  the same size classes, each a LockFreeStampedAllocator,
+                        so any thread may allocate and free, without a lock.
+
+    A request goes to the smallest class that fits both its size and its
+    alignment; anything bigger than MaxBlock, or aligned past
+    alignof(std::max_align_t), goes straight to upstream. The pools have no
+    use for the stamps (a container only keeps the pointer); the synchronized
+    pool still gets them back from the blocks, because its free lists depend
+    on them.
+*/
+namespace pools
+{
+struct monotonic_arena : std::pmr::memory_resource
+{
+    explicit monotonic_arena(size_t first_chunk = 4096,
+            std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : next_size_(std::max<size_t>(first_chunk, 64)), upstream_(upstream)
+    {}
+    monotonic_arena(const monotonic_arena&) = delete;
+    monotonic_arena& operator=(const monotonic_arena&) = delete;
+
+    // give every chunk back; whatever was allocated from the arena is gone
+    void release()
+    {
+        for(auto [p, size] : chunks_)
+        {
+            upstream_->deallocate(p, size, alignof(std::max_align_t));
+        }
+        chunks_.clear();
+        cur_ = end_ = nullptr;
+    }
+
+    ~monotonic_arena()
+    {
+        release();
+    }
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        std::byte* p = align_up(cur_, alignment);
+        if(p == nullptr || p + bytes > end_)
+        {
+            // a chunk big enough for this, even when it is big
+            next_size_ = std::max(next_size_, bytes + alignment);
+            void* chunk = upstream_->allocate(next_size_, alignof(std::max_align_t));
+            chunks_.emplace_back(chunk, next_size_);
+            cur_ = static_cast<std::byte*>(chunk);
+            end_ = cur_ + next_size_;
+            next_size_ *= 2;
+            p = align_up(cur_, alignment);
+        }
+        cur_ = p + bytes;
+        return p;
+    }
+    void do_deallocate(void*, size_t, size_t) override
+    {}
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    static std::byte* align_up(std::byte* p, size_t alignment)
+    {
+        auto addr = reinterpret_cast<uintptr_t>(p);
+        return reinterpret_cast<std::byte*>((addr + alignment - 1) & ~(alignment - 1));
+    }
+
+    std::byte* cur_ = nullptr;
+    std::byte* end_ = nullptr;
+    size_t next_size_;
+    std::pmr::memory_resource* upstream_;
+    std::vector<std::pair<void*, size_t>> chunks_;
+};
+
+namespace detail
+{
+template<size_t Size>
+struct alignas(std::min(Size, alignof(std::max_align_t))) chunk
+{
+    std::byte bytes[Size];
+};
+
+// one ClassAlloc<Size> for each Size = 8, 16, ..., MaxBlock
+template<template<size_t> typename ClassAlloc, size_t MaxBlock>
+struct size_classes
+{
+    static_assert(std::has_single_bit(MaxBlock) && MaxBlock >= 8);
+    static constexpr size_t count = std::bit_width(MaxBlock) - 3;
+
+    explicit size_classes(std::pmr::memory_resource* upstream)
+        : size_classes(upstream, std::make_index_sequence<count>{})
+    {}
+
+    // the class for a request, or count when upstream should take it
+    static size_t class_of(size_t bytes, size_t alignment)
+    {
+        const size_t size = std::max({bytes, alignment, size_t{8}});
+        if(size > MaxBlock || alignment > alignof(std::max_align_t))
+        {
+            return count;
+        }
+        return std::bit_width(size - 1) - 3;
+    }
+
+    template<typename F>
+    decltype(auto) visit(size_t cls, F&& f)
+    {
+        return visit(cls, std::forward<F>(f), std::make_index_sequence<count>{});
+    }
+
+private:
+    template<size_t... I>
+    size_classes(std::pmr::memory_resource* upstream, std::index_sequence<I...>)
+        : classes(std::pmr::polymorphic_allocator<chunk<(8 << I)>>{upstream}...)
+    {}
+
+    template<typename F, size_t... I>
+    decltype(auto) visit(size_t cls, F&& f, std::index_sequence<I...>)
+    {
+        using result = decltype(f(std::get<0>(classes)));
+        if constexpr(std::is_void_v<result>)
+        {
+            ((cls == I ? (f(std::get<I>(classes)), true) : false) || ...);
+        }
+        else
+        {
+            result res{};
+            ((cls == I ? (res = f(std::get<I>(classes)), true) : false) || ...);
+            return res;
+        }
+    }
+
+    template<size_t... I>
+    static auto make_tuple_type(std::index_sequence<I...>) -> std::tuple<ClassAlloc<(8 << I)>...>;
+
+    decltype(make_tuple_type(std::make_index_sequence<count>{})) classes;
+};
+
+template<size_t Size>
+using slab_class = SlabStampedAllocator<chunk<Size>, StampedRefStealing<chunk<Size>>,
+      std::pmr::polymorphic_allocator<chunk<Size>>>;
+
+template<size_t Size>
+using lock_free_class = LockFreeStampedAllocator<chunk<Size>, StampedRefNormal<chunk<Size>>,
+      std::pmr::polymorphic_allocator<chunk<Size>>>;
+}
+
+template<size_t MaxBlock = 1024>
+struct unsynchronized_pool : std::pmr::memory_resource
+{
+    explicit unsynchronized_pool(std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : upstream_(upstream), classes_(upstream)
+    {}
+
+private:
+    using classes = detail::size_classes<detail::slab_class, MaxBlock>;
+
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        const size_t cls = classes::class_of(bytes, alignment);
+        if(cls == classes::count)
+        {
+            return upstream_->allocate(bytes, alignment);
+        }
+        return classes_.visit(cls, [](auto& c) -> void* {
+            return c.allocate().get_ptr();
+        });
+    }
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override
+    {
+        const size_t cls = classes::class_of(bytes, alignment);
+        if(cls == classes::count)
+        {
+            return upstream_->deallocate(p, bytes, alignment);
+        }
+        classes_.visit(cls, [p](auto& c) {
+            using value = typename std::remove_reference_t<decltype(c)>::value_type;
+            // under stamp 0: nothing here compares them
+            c.deallocate(decltype(c.allocate()){static_cast<value*>(p)});
+        });
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    std::pmr::memory_resource* upstream_;
+    classes classes_;
+};
+
+/*
+    upstream must be safe to call from several threads at once; the default
+    resource (new / delete) is.
+*/
+template<size_t MaxBlock = 1024>
+struct synchronized_pool : std::pmr::memory_resource
+{
+    explicit synchronized_pool(std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : upstream_(upstream), classes_(upstream)
+    {}
+
+private:
+    using classes = detail::size_classes<detail::lock_free_class, MaxBlock>;
+
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        const size_t cls = classes::class_of(bytes, alignment);
+        if(cls == classes::count)
+        {
+            return upstream_->allocate(bytes, alignment);
+        }
+        return classes_.visit(cls, [](auto& c) -> void* {
+            return c.allocate().get_ptr();
+        });
+    }
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override
+    {
+        const size_t cls = classes::class_of(bytes, alignment);
+        if(cls == classes::count)
+        {
+            return upstream_->deallocate(p, bytes, alignment);
+        }
+        classes_.visit(cls, [p](auto& c) {
+            using value = typename std::remove_reference_t<decltype(c)>::value_type;
+            c.deallocate(static_cast<value*>(p));
+        });
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    std::pmr::memory_resource* upstream_;
+    classes classes_;
+};
+}
@@ -1,7 +1,7 @@
 #include "StampedAllocator.h"
 #include "../../exercises/chapter10/test_pool.h"
 #include "../lock_free_stack/thread_safe_alloc.h"
-#include "../lock_free_stack/backoff.h"
+#include "../backoff/backoff.h"
 
 #define true_cast(x) true
 
@@ -81,12 +81,9 @@ private:
         return head.compare_exchange_strong(localHead, node);
     }
     std::atomic<StampedRef<StackNode<T>>> head;
-    static thread_local backoff backoff;
+    static inline thread_local backoff::tiered<> backoff;
 };
 
-template<>
-thread_local backoff ConcurrentStack<int>::backoff{2, 250};
-
 int main()
 {
     ConcurrentStack<int> s;
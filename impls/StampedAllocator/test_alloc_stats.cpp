@@ -0,0 +1,156 @@
+#include "StampedAllocator.h"
+#include "lock_free_allocator.h"
+#include "../lock_free_stack/thread_safe_alloc.h"
+#include <cassert>
+#include <chrono>
+#include <format>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+struct node
+{
+    long value;
+};
+
+using counted = alloc_stats::counters<>;
+
+void single_thread_test()
+{
+    StampedAllocator<node, StampedRefNormal<node>, std::allocator<node>, counted> alloc;
+    std::vector<StampedRefNormal<node>> refs;
+    for(long i = 0; i < 100; ++i)
+    {
+        refs.push_back(alloc.construct(i));
+    }
+    for(int i = 0; i < 40; ++i)
+    {
+        alloc.free(refs.back());
+        refs.pop_back();
+    }
+    for(long i = 0; i < 10; ++i)
+    {
+        refs.push_back(alloc.construct(i));
+    }
+
+    auto t = alloc.stats();
+    assert(t.live == 70);
+    // folded every 32, so a peak can be missed by less than that
+    assert(t.high_watermark > 100 - 32 && t.high_watermark <= 100);
+    assert(t.free_list == 30);
+    assert(t.base_calls == 100);
+    assert(t.stamp_wraps == 0 && t.cross_thread == 0);
+
+    for(auto r : refs)
+    {
+        alloc.free(r);
+    }
+    assert(alloc.stats().live == 0 && alloc.stats().free_list == 100);
+}
+
+void stamp_wrap_test()
+{
+    // 7 stamps, so the 7th and 14th reuse wrap
+    SlabStampedAllocator<node, StampedRefStealing<node>, std::allocator<node>, 16, counted> alloc;
+    auto r = alloc.construct(0l);
+    for(long i = 1; i <= 20; ++i)
+    {
+        alloc.free(r);
+        r = alloc.construct(i);
+    }
+    auto t = alloc.stats();
+    assert(t.stamp_wraps == 2);
+    assert(t.base_calls == 1 && t.live == 1 && t.free_list == 15);
+    alloc.free(r);
+}
+
+// one thread allocates, another frees everything
+template<typename Allocator>
+void cross_thread_test()
+{
+    static constexpr size_t count = 1000;
+    Allocator alloc;
+    std::vector<StampedRefNormal<node>> refs;
+
+    std::thread([&](){
+        for(size_t i = 0; i < count; ++i)
+        {
+            refs.push_back(alloc.allocate());
+        }
+        // a few come back on the same thread
+        for(int i = 0; i < 10; ++i)
+        {
+            alloc.deallocate(refs.back());
+            refs.pop_back();
+        }
+    }).join();
+    std::thread([&](){
+        for(auto r : refs)
+        {
+            alloc.deallocate(r);
+        }
+    }).join();
+
+    auto t = alloc.stats();
+    assert(t.cross_thread == count - 10);
+    assert(t.live == 0 && t.high_watermark <= static_cast<int64_t>(count) && t.high_watermark > static_cast<int64_t>(count) - 32);
+    // and every block is free again, plus what is left of the last slab
+    assert(t.free_list >= static_cast<int64_t>(count));
+}
+
+/*
+    Threads allocate and free as fast as they can; the counters should cost
+    a few relaxed increments on a line nobody else writes.
+*/
+template<typename Allocator>
+long long churn(size_t threads)
+{
+    static constexpr size_t total = 1 << 20;
+    Allocator alloc;
+    std::vector<std::thread> workers;
+
+    auto start_time = std::chrono::steady_clock::now();
+    for(size_t t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&alloc, rounds = total / threads](){
+            StampedRefNormal<node> held[4]{ nullptr, nullptr, nullptr, nullptr };
+            for(auto& h : held)
+            {
+                h = alloc.allocate();
+            }
+            for(size_t i = 0; i < rounds; ++i)
+            {
+                auto& h = held[i % 4];
+                alloc.deallocate(h);
+                h = alloc.allocate();
+            }
+            for(auto& h : held)
+            {
+                alloc.deallocate(h);
+            }
+        });
+    }
+    for(auto& th : workers)
+    {
+        th.join();
+    }
+    auto total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_time);
+    return (total_time / total).count();
+}
+
+int main()
+{
+    single_thread_test();
+    stamp_wrap_test();
+    cross_thread_test<ThreadSafeAllocator<node, counted>>();
+    cross_thread_test<LockFreeStampedAllocator<node, StampedRefNormal<node>, std::allocator<node>, backoff::tiered<>, 64, counted>>();
+
+    using lock_free = LockFreeStampedAllocator<node>;
+    using lock_free_counted = LockFreeStampedAllocator<node, StampedRefNormal<node>, std::allocator<node>, backoff::tiered<>, 64, counted>;
+    for(size_t threads = 1; threads <= 8; threads *= 2)
+    {
+        std::cout << std::format("{} threads: LockFreeStampedAllocator {}ns/op, with counters {}ns/op\n",
+                threads, churn<lock_free>(threads), churn<lock_free_counted>(threads));
+    }
+}
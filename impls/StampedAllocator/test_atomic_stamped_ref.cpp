@@ -0,0 +1,102 @@
+#include "atomic_stamped_ref.h"
+#include <cassert>
+#include <chrono>
+#include <format>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+struct alignas(8) node
+{
+    long value;
+};
+
+using libatomic_ref = std::atomic<StampedRefNormal<node>>;
+using cmpxchg16b_ref = atomic_stamped_ref<StampedRefNormal<node>>;
+using packed_ref = atomic_stamped_ref<StampedRefPacked<node>>;
+
+static_assert(sizeof(StampedRefPacked<node>) == 8);
+static_assert(packed_ref::mode == stamped_atomic_mode::native);
+#if defined(__x86_64__) && !defined(__SANITIZE_THREAD__)
+static_assert(cmpxchg16b_ref::mode == stamped_atomic_mode::cmpxchg16b);
+#endif
+
+void packed_test()
+{
+    static_assert(StampedRefPacked<node>::max_stamp() == (size_t{1} << 19) - 1);
+    node n{ 7 };
+    StampedRefPacked<node> r{&n};
+
+    for(size_t stamp : {size_t{0}, size_t{5}, size_t{8}, size_t{12345}, StampedRefPacked<node>::max_stamp()})
+    {
+        r.setStamp(stamp);
+        assert(r.getStamp() == stamp);
+        assert(r.get_ptr() == &n);
+        assert(r->value == 7);
+    }
+    r.incStamp();
+    assert(r.getStamp() == 0 && r == &n);
+
+    StampedRefPacked<node> empty{nullptr, 3};
+    assert(empty == nullptr && empty.getStamp() == 3);
+}
+
+/*
+    Threads bump the stamp with load / CAS loops: every increment lands, and
+    the pointer half never changes.
+*/
+template<typename Atomic>
+long long ns_per_cas(size_t threads)
+{
+    static constexpr size_t total = 1 << 18;
+    node n{ 0 };
+    Atomic a{ {&n, 0} };
+    std::vector<std::thread> workers;
+
+    auto start_time = std::chrono::steady_clock::now();
+    for(size_t t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&a, per_thread = total / threads](){
+            for(size_t i = 0; i < per_thread; ++i)
+            {
+                auto expected = a.load();
+                auto desired = expected;
+                do
+                {
+                    desired = expected;
+                    desired.incStamp();
+                }
+                while(!a.compare_exchange_weak(expected, desired));
+            }
+        });
+    }
+    for(auto& th : workers)
+    {
+        th.join();
+    }
+    auto total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_time);
+
+    auto last = a.load();
+    assert(last.getStamp() == total);
+    assert(last.get_ptr() == &n);
+    return (total_time / total).count();
+}
+
+int main()
+{
+    packed_test();
+
+    std::cout << std::format("StampedRefNormal: std::atomic is_lock_free {}, atomic_stamped_ref mode {}\n",
+            libatomic_ref{ {nullptr} }.is_lock_free(), mode_name(cmpxchg16b_ref::mode));
+    std::cout << std::format("StampedRefPacked: atomic_stamped_ref mode {}\n", mode_name(packed_ref::mode));
+
+    for(size_t threads = 1; threads <= 4; threads *= 2)
+    {
+        std::cout << std::format("{} threads: libatomic {}ns/cas, cmpxchg16b {}ns/cas, packed {}ns/cas\n",
+                threads,
+                ns_per_cas<libatomic_ref>(threads),
+                ns_per_cas<cmpxchg16b_ref>(threads),
+                ns_per_cas<packed_ref>(threads));
+    }
+}
@@ -0,0 +1,195 @@
+#include "lock_free_allocator.h"
+#include "../lock_free_stack/thread_safe_alloc.h"
+#include <cassert>
+#include <chrono>
+#include <format>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+struct node
+{
+    size_t owner;
+    size_t round;
+};
+
+/*
+    Each thread keeps a handful of blocks, writes its mark into them, and
+    trades them back and forth with the allocator: a block handed to two
+    threads at once would show the other thread's mark.
+*/
+template<typename Allocator>
+long long exclusive_test(size_t threads)
+{
+    static constexpr size_t total = 1 << 18;
+    static constexpr size_t held = 8;
+    Allocator alloc;
+    std::vector<std::thread> workers;
+
+    auto start_time = std::chrono::steady_clock::now();
+    for(size_t t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&alloc, t, rounds = total / threads](){
+            std::vector<StampedRefNormal<node>> mine;
+            for(size_t i = 0; i < rounds; ++i)
+            {
+                if(mine.size() == held || (mine.size() > 0 && i % 3 == 0))
+                {
+                    auto ref = mine.back();
+                    mine.pop_back();
+                    assert(ref->owner == t && ref->round < i);
+                    alloc.deallocate(ref);
+                }
+                else
+                {
+                    auto ref = alloc.allocate();
+                    new (ref.get_ptr()) node{t, i};
+                    mine.push_back(ref);
+                }
+            }
+            for(auto ref : mine)
+            {
+                assert(ref->owner == t);
+                alloc.deallocate(ref);
+            }
+        });
+    }
+    for(auto& th : workers)
+    {
+        th.join();
+    }
+    auto total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_time);
+    return (total_time / total).count();
+}
+
+void stamp_test()
+{
+    LockFreeStampedAllocator<node, StampedRefNormal<node>, std::allocator<node>, backoff::tiered<>, 4> alloc;
+
+    // one slab: the first block out, the rest queued in address order
+    auto a = alloc.allocate();
+    auto b = alloc.allocate();
+    assert(b.get_ptr() > a.get_ptr());
+    assert(a.getStamp() == 0 && b.getStamp() == 0);
+
+    // back on top, under a new stamp
+    node* freed = b.get_ptr();
+    alloc.deallocate(b);
+    b = alloc.allocate();
+    assert(b == freed && b.getStamp() == 1);
+    alloc.deallocate(b);
+    alloc.deallocate(a);
+    a = alloc.allocate();
+    b = alloc.allocate();
+    assert(b == freed && b.getStamp() == 2);
+}
+
+template<typename T>
+using line_ref = StampedRefStealing<T, 64>;
+
+/*
+    Treiber stack over the allocator, with Ref for both head and the links.
+    Threads push and pop in turn; every value pushed is popped exactly once.
+*/
+template<template<typename> typename Ref>
+struct treiber_node
+{
+    size_t value;
+    Ref<treiber_node> prev;
+};
+
+template<template<typename> typename Ref>
+long long treiber_test(size_t threads)
+{
+    using node = treiber_node<Ref>;
+    static constexpr size_t total = 1 << 18;
+    LockFreeStampedAllocator<node, Ref<node>> alloc;
+    atomic_stamped_ref<Ref<node>> head{ nullptr };
+    std::atomic<size_t> popped_sum{ 0 };
+    std::vector<std::thread> workers;
+
+    auto start_time = std::chrono::steady_clock::now();
+    for(size_t t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&, t, rounds = total / threads](){
+            size_t sum = 0;
+            for(size_t i = 0; i < rounds; ++i)
+            {
+                Ref<node> n = alloc.allocate();
+                assert(reinterpret_cast<uintptr_t>(n.get_ptr()) % Ref<node>::alignment() == 0);
+                new (n.get_ptr()) node{t * rounds + i, nullptr};
+                Ref<node> top = head.load();
+                do
+                {
+                    n->prev = top;
+                }
+                while(!head.compare_exchange_weak(top, n));
+
+                top = head.load();
+                while(!head.compare_exchange_weak(top, top->prev));
+                sum += top->value;
+                alloc.deallocate(top);
+            }
+            popped_sum += sum;
+        });
+    }
+    for(auto& th : workers)
+    {
+        th.join();
+    }
+    auto total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_time);
+
+    const size_t pushed = total / threads * threads;
+    assert(head.load() == nullptr);
+    assert(popped_sum.load() == pushed * (pushed - 1) / 2);
+    return (total_time / total).count();
+}
+
+void line_ref_test()
+{
+    using node = treiber_node<line_ref>;
+    static_assert(sizeof(line_ref<node>) == 8);
+    static_assert(line_ref<node>::max_stamp() == 63);
+    static_assert(StampedRefStealing<node>::max_stamp() == 7);
+    static_assert(atomic_stamped_ref<line_ref<node>>::mode == stamped_atomic_mode::native);
+
+    LockFreeStampedAllocator<node, line_ref<node>> alloc;
+    std::vector<line_ref<node>> refs;
+    for(int i = 0; i < 100; ++i)
+    {
+        refs.push_back(alloc.allocate());
+    }
+    for(auto r : refs)
+    {
+        // a cache line each
+        assert(reinterpret_cast<uintptr_t>(r.get_ptr()) % 64 == 0);
+    }
+    auto r = refs.back();
+    node* n = r.get_ptr();
+    for(size_t stamp = 1; stamp < 63; ++stamp)
+    {
+        alloc.deallocate(r);
+        r = alloc.allocate();
+        assert(r == n && r.getStamp() == stamp);
+    }
+}
+
+int main()
+{
+    stamp_test();
+    line_ref_test();
+    for(size_t threads = 1; threads <= 8; threads *= 2)
+    {
+        std::cout << std::format("{} threads: ThreadSafeAllocator {}ns/op, LockFreeStampedAllocator {}ns/op\n",
+                threads,
+                exclusive_test<ThreadSafeAllocator<node>>(threads),
+                exclusive_test<LockFreeStampedAllocator<node>>(threads));
+    }
+    for(size_t threads = 1; threads <= 8; threads *= 2)
+    {
+        std::cout << std::format("{} threads: Treiber with StampedRefNormal {}ns/op, with StampedRefStealing<T, 64> {}ns/op\n",
+                threads, treiber_test<StampedRefNormal>(threads), treiber_test<line_ref>(threads));
+    }
+}
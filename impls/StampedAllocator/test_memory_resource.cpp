@@ -0,0 +1,207 @@
+#include "memory_resource.h"
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <list>
+#include <new>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// every call to the global operator new, from any thread
+static std::atomic<size_t> news{ 0 };
+
+void* operator new(size_t size)
+{
+    news.fetch_add(1, std::memory_order_relaxed);
+    if(void* p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+// out of line, or GCC sees free() meet operator new and warns
+[[gnu::noinline]] void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+[[gnu::noinline]] void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+// containers of every shape keep their contents, and blocks are aligned as asked
+void containers_test(std::pmr::memory_resource& r)
+{
+    std::pmr::vector<int> v{&r};
+    std::pmr::list<long> l{&r};
+    std::pmr::unordered_map<int, int> m{&r};
+    for(int i = 0; i < 5000; ++i)
+    {
+        v.push_back(i);
+        l.push_back(i);
+        m[i] = 2 * i;
+        if(i % 3 == 0)
+        {
+            l.pop_front();
+            m.erase(i / 2);
+        }
+    }
+    for(int i = 0; i < 5000; ++i)
+    {
+        assert(v[i] == i);
+        assert(m.count(i) == 0 || m[i] == 2 * i);
+    }
+    long expected = 5000 - static_cast<long>(l.size());
+    for(long x : l)
+    {
+        assert(x == expected++);
+    }
+
+    for(size_t align : {1, 2, 8, 16, 64, 256})
+    {
+        for(size_t bytes : {1, 7, 24, 100, 1000, 5000})
+        {
+            void* p = r.allocate(bytes, align);
+            assert(reinterpret_cast<uintptr_t>(p) % align == 0);
+            std::fill_n(static_cast<char*>(p), bytes, 'x');
+            r.deallocate(p, bytes, align);
+        }
+    }
+}
+
+// threads free each other's blocks through the synchronized pool
+void cross_thread_test()
+{
+    static constexpr size_t items = 20000;
+    pools::synchronized_pool<> pool;
+    std::pmr::list<size_t> made{&pool};
+    for(size_t i = 0; i < items; ++i)
+    {
+        made.push_back(i);
+    }
+
+    std::vector<std::thread> workers;
+    std::atomic<size_t> sum{ 0 };
+    std::vector<std::pmr::list<size_t>> parts;
+    for(size_t t = 0; t < 4; ++t)
+    {
+        parts.emplace_back(&pool);
+        auto it = made.begin();
+        std::advance(it, made.size() / (4 - t));
+        parts.back().splice(parts.back().end(), made, made.begin(), it);
+    }
+    for(auto& part : parts)
+    {
+        workers.emplace_back([&part, &sum, &pool](){
+            std::pmr::list<size_t> mine{&pool};
+            size_t s = 0;
+            for(size_t x : part)
+            {
+                s += x;
+                mine.push_back(x);
+            }
+            part.clear();
+            sum += s;
+        });
+    }
+    for(auto& th : workers)
+    {
+        th.join();
+    }
+    assert(sum.load() == items * (items - 1) / 2);
+}
+
+struct run_stats
+{
+    long long ns;
+    double news_per_insert;
+};
+
+/*
+    The harness's pattern: every thread counts values into a frequency map
+    of its own. MakeResource gives a thread its resource, or nullptr for
+    plain std::allocator.
+*/
+template<typename MakeResource>
+run_stats frequency_maps(size_t threads, MakeResource make)
+{
+    static constexpr size_t per_thread = 20000;
+    std::vector<std::thread> workers;
+    const size_t before = news.load();
+
+    auto start_time = std::chrono::steady_clock::now();
+    for(size_t t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&make, t](){
+            auto resource = make();
+            std::mt19937 rng{ static_cast<unsigned>(t) };
+            if(resource)
+            {
+                std::pmr::unordered_map<size_t, size_t> freqs{resource.get()};
+                for(size_t i = 0; i < per_thread; ++i)
+                {
+                    freqs[rng()]++;
+                }
+            }
+            else
+            {
+                std::unordered_map<size_t, size_t> freqs;
+                for(size_t i = 0; i < per_thread; ++i)
+                {
+                    freqs[rng()]++;
+                }
+            }
+        });
+    }
+    for(auto& th : workers)
+    {
+        th.join();
+    }
+    auto total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_time);
+    return { total_time.count() / static_cast<long long>(threads * per_thread),
+        static_cast<double>(news.load() - before) / (threads * per_thread) };
+}
+
+int main()
+{
+    {
+        pools::monotonic_arena arena;
+        containers_test(arena);
+    }
+    {
+        pools::unsynchronized_pool<> pool;
+        containers_test(pool);
+    }
+    {
+        pools::synchronized_pool<> pool;
+        containers_test(pool);
+    }
+    cross_thread_test();
+
+    pools::synchronized_pool<> shared;
+    for(size_t threads = 1; threads <= 8; threads *= 2)
+    {
+        auto plain = frequency_maps(threads, [](){ return std::unique_ptr<std::pmr::memory_resource>{}; });
+        auto arena = frequency_maps(threads, [](){
+            return std::unique_ptr<std::pmr::memory_resource>{std::make_unique<pools::monotonic_arena>()};
+        });
+        auto pool = frequency_maps(threads, [](){
+            return std::unique_ptr<std::pmr::memory_resource>{std::make_unique<pools::unsynchronized_pool<>>()};
+        });
+        // one pool for everyone; the deleter leaves it be
+        using borrowed = std::unique_ptr<std::pmr::memory_resource, void(*)(std::pmr::memory_resource*)>;
+        auto sync = frequency_maps(threads, [&shared](){
+            return borrowed{&shared, [](std::pmr::memory_resource*){}};
+        });
+        std::cout << std::format("{} threads: std::allocator {}ns, {:.3f} news/insert; monotonic_arena {}ns, {:.3f}; "
+                "unsynchronized_pool {}ns, {:.3f}; shared synchronized_pool {}ns, {:.3f}\n",
+                threads, plain.ns, plain.news_per_insert, arena.ns, arena.news_per_insert,
+                pool.ns, pool.news_per_insert, sync.ns, sync.news_per_insert);
+    }
+}
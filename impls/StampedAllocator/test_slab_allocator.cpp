@@ -0,0 +1,142 @@
+#include "StampedAllocator.h"
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <new>
+#include <random>
+#include <vector>
+
+// every call to the global operator new, from anywhere
+static size_t news = 0;
+
+void* operator new(size_t size)
+{
+    ++news;
+    if(void* p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+struct node
+{
+    long value;
+    node* next;
+};
+
+void slab_test()
+{
+    SlabStampedAllocator<node, StampedRefNormal<node>, std::allocator<node>, 4> alloc;
+
+    // carved in address order
+    std::vector<StampedRefNormal<node>> refs;
+    for(long i = 0; i < 4; ++i)
+    {
+        refs.push_back(alloc.construct(i, nullptr));
+    }
+    for(size_t i = 1; i < refs.size(); ++i)
+    {
+        assert(refs[i].get_ptr() == refs[i - 1].get_ptr() + 1);
+        assert(refs[i]->value == static_cast<long>(i));
+    }
+
+    // the last freed comes back first, stamp bumped
+    node* freed = refs[1].get_ptr();
+    alloc.free(refs[1]);
+    alloc.free(refs[2]);
+    auto again = alloc.construct(20, nullptr);
+    assert(again == refs[2].get_ptr() && again.getStamp() == 1);
+    alloc.free(again);
+    again = alloc.construct(21, nullptr);
+    assert(again.getStamp() == 2 && again->value == 21);
+    auto other = alloc.construct(10, nullptr);
+    assert(other == freed && other.getStamp() == 1);
+
+    // neither free nor reuse touched operator new
+    size_t before = news;
+    for(int round = 0; round < 100; ++round)
+    {
+        alloc.free(other);
+        other = alloc.construct(round, nullptr);
+    }
+    assert(news == before);
+    assert(other == freed && other.getStamp() == 101);
+
+    // the fifth object opens a second slab
+    auto fifth = alloc.construct(5, nullptr);
+    assert(fifth->value == 5);
+    assert(news > before);
+}
+
+/*
+    Keep live objects around, then free a random one and construct a
+    replacement, many times over; count ns and operator new calls per
+    construct / free pair.
+*/
+template<typename Allocator>
+void churn(const char* name)
+{
+    static constexpr size_t live = 1 << 12;
+    static constexpr size_t rounds = 1 << 20;
+
+    Allocator alloc;
+    std::mt19937 rng{ 42 };
+    std::vector<decltype(alloc.construct(0l, nullptr))> refs;
+    for(size_t i = 0; i < live; ++i)
+    {
+        refs.push_back(alloc.construct(static_cast<long>(i), nullptr));
+    }
+
+    size_t before = news;
+    auto start_time = std::chrono::steady_clock::now();
+    long sum = 0;
+    for(size_t i = 0; i < rounds; ++i)
+    {
+        auto& r = refs[rng() % live];
+        sum += r->value;
+        alloc.free(r);
+        r = alloc.construct(static_cast<long>(i), nullptr);
+    }
+    auto total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_time);
+    const size_t calls = news - before;
+
+    // walk the live objects
+    start_time = std::chrono::steady_clock::now();
+    for(int pass = 0; pass < 64; ++pass)
+    {
+        for(auto& r : refs)
+        {
+            sum += r->value;
+        }
+    }
+    auto walk_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_time);
+
+    std::cout << std::format("{}: {}ns per free + construct, {:.3f} operator new calls per op, {}ns per 64 walks ({})\n",
+            name, (total_time / rounds).count(), static_cast<double>(calls) / rounds,
+            walk_time.count() / 64, sum % 2);
+    for(auto& r : refs)
+    {
+        alloc.free(r);
+    }
+}
+
+int main()
+{
+    slab_test();
+    churn<StampedAllocator<node>>("StampedAllocator");
+    churn<SlabStampedAllocator<node>>("SlabStampedAllocator");
+    churn<SlabStampedAllocator<node, StampedRefStealing<node>>>("SlabStampedAllocator, stealing refs");
+}
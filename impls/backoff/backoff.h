@@ -0,0 +1,104 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+/*
+    Backoff policies for retry loops.
+
+    A policy is a small object made fresh for each operation: call it after
+    every failed attempt (a lost CAS, a slot that is not ready yet) and it
+    waits a little longer each time.
+
+        for(backoff::tiered<> b; !try_it(); b());
+
+    tiered waits in three tiers:
+
+    spin:  exponentially longer runs of the pause instruction, which tells
+           the core we are spinning (frees the pipeline for its sibling
+           hyperthread, avoids the memory order flush on exit). Skipped on a
+           single core, where spinning only delays whoever we are waiting for.
+    yield: a few rounds of std::this_thread::yield.
+    sleep: exponentially longer sleeps, capped at MaxSleepUs.
+
+    Every spin run and sleep is jittered by a per-thread xorshift so threads
+    that failed together do not retry together.
+
+    none is the policy for "just retry", for comparing against.
+*/
+namespace backoff
+{
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#else
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+// xorshift32 (Marsaglia 2003), one stream per thread
+inline uint32_t xorshift()
+{
+    static thread_local uint32_t state =
+        static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id())) | 1;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+template<uint32_t MaxSpins = 1024, uint32_t YieldRounds = 4, uint32_t MaxSleepUs = 1000>
+struct tiered
+{
+    static_assert(MaxSpins > 0 && MaxSleepUs > 0);
+
+    void operator()()
+    {
+        if(spin && spins_ <= MaxSpins)
+        {
+            // somewhere in [spins_ / 2, spins_)
+            for(uint32_t n = spins_ / 2 + xorshift() % (spins_ / 2 + 1); n > 0; --n)
+            {
+                cpu_relax();
+            }
+            spins_ *= 2;
+        }
+        else if(yields_ < YieldRounds)
+        {
+            ++yields_;
+            std::this_thread::yield();
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds{sleepUs_ / 2 + xorshift() % (sleepUs_ / 2 + 1)});
+            sleepUs_ = std::min(MaxSleepUs, 2 * sleepUs_);
+        }
+    }
+
+    void reset()
+    {
+        *this = tiered{};
+    }
+
+private:
+    static inline const bool spin = std::thread::hardware_concurrency() > 1;
+
+    uint32_t spins_ = 2;
+    uint32_t yields_ = 0;
+    uint32_t sleepUs_ = 2;
+};
+
+struct none
+{
+    void operator()()
+    {}
+    void reset()
+    {}
+};
+}
@@ -0,0 +1,147 @@
+#include "backoff.h"
+#include "../lock_free_stack/lock_free_stack.h"
+#include "../mrmw_queue/mrmw_queue.h"
+#include "../../exercises/chapter8/97.cpp"
+#include <cassert>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+// counts the failed attempts that reached the policy
+template<typename Backoff>
+struct counted : Backoff
+{
+    static inline std::atomic<size_t> failures{ 0 };
+
+    void operator()()
+    {
+        failures.fetch_add(1, std::memory_order_relaxed);
+        Backoff::operator()();
+    }
+};
+
+struct run_stats
+{
+    double mops;
+    double failures_per_op;
+};
+
+template<typename Backoff, typename Body>
+run_stats measure(size_t threads, size_t ops_per_thread, Body body)
+{
+    counted<Backoff>::failures.store(0);
+    std::vector<std::thread> workers;
+
+    auto start_time = steady_clock::now();
+    for(size_t t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&body, t, ops_per_thread](){
+            for(size_t i = 0; i < ops_per_thread; ++i)
+            {
+                body(t, i);
+            }
+        });
+    }
+    for(auto& th : workers)
+    {
+        th.join();
+    }
+    auto total_time = duration_cast<nanoseconds>(steady_clock::now() - start_time);
+
+    const double ops = static_cast<double>(threads * ops_per_thread);
+    return { ops * 1e3 / total_time.count(),
+        static_cast<double>(counted<Backoff>::failures.load()) / ops };
+}
+
+// every thread alternates push and pop
+template<typename Backoff>
+run_stats stack_run(size_t threads)
+{
+    lock_free_stack<int, ThreadSafeAllocator<StackNode<int>>,
+        EliminationArena<MyStampedRef<StackNode<int>>>, counted<Backoff>> S;
+    return measure<Backoff>(threads, (1 << 16) / threads, [&S](size_t, size_t i){
+        if(i % 2 == 0)
+        {
+            S.enq(static_cast<int>(i));
+        }
+        else
+        {
+            S.deq();
+        }
+    });
+}
+
+// half the threads enq, half deq, through a small ring
+template<typename Backoff>
+run_stats queue_run(size_t threads)
+{
+    MRMWQueue<int, counted<Backoff>> q(64);
+    return measure<Backoff>(threads, (1 << 16) / threads, [&q](size_t t, size_t i){
+        if(t % 2 == 0)
+        {
+            while(!q.enq(static_cast<int>(i)))
+            {
+                std::this_thread::yield();
+            }
+        }
+        else
+        {
+            while(!q.deq())
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+}
+
+// threads alternate between two rooms, doing nothing inside
+template<typename Backoff>
+run_stats rooms_run(size_t threads)
+{
+    Rooms<counted<Backoff>> rooms;
+    std::atomic<int> inside[2]{};
+    return measure<Backoff>(threads, (1 << 14) / threads, [&](size_t t, size_t i){
+        const int room = (t + i) % 2;
+        rooms.enter(room);
+        ++inside[room];
+        assert(inside[1 - room].load() == 0);
+        --inside[room];
+        rooms.exit([](){});
+    });
+}
+
+template<template<typename> typename Run>
+void compare(const char* name)
+{
+    for(size_t threads = 2; threads <= 16; threads *= 2)
+    {
+        auto with = Run<backoff::tiered<>>{}(threads);
+        auto without = Run<backoff::none>{}(threads);
+        std::cout << std::format("{} {} threads: tiered {:.2f} Mops/s, {:.3f} failures/op; none {:.2f} Mops/s, {:.3f} failures/op\n",
+                name, threads, with.mops, with.failures_per_op, without.mops, without.failures_per_op);
+    }
+}
+
+template<typename Backoff>
+struct stack_bench
+{
+    run_stats operator()(size_t threads) { return stack_run<Backoff>(threads); }
+};
+template<typename Backoff>
+struct queue_bench
+{
+    run_stats operator()(size_t threads) { return queue_run<Backoff>(threads); }
+};
+template<typename Backoff>
+struct rooms_bench
+{
+    run_stats operator()(size_t threads) { return rooms_run<Backoff>(threads); }
+};
+
+int main()
+{
+    compare<stack_bench>("stack");
+    compare<queue_bench>("queue");
+    compare<rooms_bench>("rooms");
+}
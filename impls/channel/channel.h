@@ -0,0 +1,559 @@
+#pragma once
+/*
+    Go style channels.
+
+        channels::channel<int> a;                   // unbuffered
+        channels::buffered_channel<int> b{64};      // room for 64 values
+
+        int fired = channels::select(
+            channels::on_recv(a, [](std::optional<int> x){ ... }),  // nullopt: a is closed
+            channels::on_send(b, 5, [](){ ... }));
+
+    An unbuffered channel is a (fair) SynchronousQueue: send waits for a recv
+    to take the value. A buffered channel is an MRMWQueue, so T needs
+    queue_traits: send only waits while it is full, recv while it is empty.
+
+    close() belongs to the sending side and comes after its last send -
+    sending on a closed channel is a bug, as in Go. Once a channel is closed
+    and drained, recv returns nullopt straight away, and a select recv case on
+    it is always ready (with nullopt).
+
+    select waits until one of its cases can go ahead, performs that one and
+    runs its callback, returning the case's index. Going ahead is always one
+    atomic step - one transfer on the synchronous queue, one enq / deq on the
+    ring, or one CAS claiming a blocked select (below) - and select stops at
+    the first success, so it never commits to two cases. The cases are tried
+    from a rotating starting point so that no case starves the others.
+    try_select is select with Go's default case: -1 if nothing is ready.
+
+    Blocking: a select that finds nothing ready registers each case with its
+    channel, re-checks, and parks on a single flag. Every event that can make a
+    case ready - a value entering or leaving a ring, a plain send / recv
+    queueing up in a synchronous queue, close - wakes the channel's registered
+    selects, and a select wakes once however many of its channels fire. The
+    usual Dekker pairing (as in the coroutine waiter_list) keeps wakeups from
+    getting lost:
+
+        select: register (seq_cst)  -> re-check the channels (seq_cst)
+        event : publish (seq_cst)   -> look for registrations (seq_cst)
+
+    Channels with no select registered never take their lock.
+
+    A select cannot queue up in several synchronous queues at once without
+    risking two hand-offs, so it never waits inside one. A plain send / recv
+    does, and a select's try_offer / try_poll finds it there. For the other
+    direction a select's registration on an unbuffered channel carries the
+    value it would send (or room for the value it would receive), and a
+    partner - a plain send / recv, or another select - claims the select
+    outright: it CASes the select's fired index from none to that case while
+    holding the channel's lock, moves the value and wakes it. A select only
+    commits to a case itself while holding the locks of all its channels
+    (taken in address order), so a claim and its own commit exclude each
+    other. That is also what lets two selects meet across an unbuffered
+    channel.
+*/
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "../mrmw_queue/mrmw_queue.h"
+#include "../synchronous_queue/synchronous_queue.h"
+
+namespace channels
+{
+namespace detail
+{
+// one per blocked select, shared by all of its registrations
+struct selector
+{
+    static constexpr int none = -1;
+
+    // only called with the lock of the channel the case is registered on
+    bool claim(int index)
+    {
+        int expected = none;
+        return fired.compare_exchange_strong(expected, index);
+    }
+
+    void wake()
+    {
+        std::lock_guard<std::mutex> lk{parkLock};
+        woken = true;
+        parkCv.notify_one();
+    }
+
+    void park()
+    {
+        std::unique_lock<std::mutex> lk{parkLock};
+        parkCv.wait(lk, [this](){ return woken; });
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lk{parkLock};
+        woken = false;
+    }
+
+    // the case a partner completed for us
+    std::atomic<int> fired{ none };
+
+    bool woken = false;
+    std::mutex parkLock;
+    std::condition_variable parkCv;
+};
+
+template<typename T>
+struct registration
+{
+    selector* sel;
+    int index;
+    bool isSend;
+    // the value a send case offers / where a recv case wants its value
+    std::optional<T>* slot;
+};
+
+// what both kinds of channel share: close and the registered selects
+template<typename T>
+struct channel_core
+{
+    channel_core() = default;
+    channel_core(const channel_core&) = delete;
+    channel_core& operator=(const channel_core&) = delete;
+
+    bool closed() const
+    {
+        return closed_.load();
+    }
+
+    std::mutex& mutex()
+    {
+        return lock_;
+    }
+
+    // the caller holds mutex()
+    void enlist(const registration<T>& r)
+    {
+        waiters_.push_back(r);
+        registered_.store(waiters_.size());
+    }
+
+    // the caller holds mutex()
+    void delist(selector* sel)
+    {
+        std::erase_if(waiters_, [sel](const registration<T>& r){ return r.sel == sel; });
+        registered_.store(waiters_.size());
+    }
+
+protected:
+    // something on this channel may have become ready
+    void notify(bool locked)
+    {
+        if(registered_.load() == 0)
+        {
+            return;
+        }
+        std::unique_lock<std::mutex> lk{lock_, std::defer_lock};
+        if(!locked)
+        {
+            lk.lock();
+        }
+        for(auto& r : waiters_)
+        {
+            r.sel->wake();
+        }
+    }
+
+    std::mutex lock_;
+    std::vector<registration<T>> waiters_;
+    std::atomic<size_t> registered_{ 0 };
+    std::atomic<bool> closed_{ false };
+};
+
+/*
+    All the mutexes of a select's channels, locked in address order. Several
+    cases may share a channel.
+*/
+template<size_t N>
+struct lock_set
+{
+    explicit lock_set(std::array<std::mutex*, N> locks)
+        : locks_(locks)
+    {
+        std::sort(locks_.begin(), locks_.end(), std::less<std::mutex*>{});
+        count_ = std::unique(locks_.begin(), locks_.end()) - locks_.begin();
+    }
+
+    void lock()
+    {
+        for(size_t i = 0; i < count_; ++i)
+        {
+            locks_[i]->lock();
+        }
+    }
+
+    void unlock()
+    {
+        for(size_t i = count_; i > 0; --i)
+        {
+            locks_[i - 1]->unlock();
+        }
+    }
+
+private:
+    std::array<std::mutex*, N> locks_;
+    size_t count_;
+};
+
+inline size_t next_start(size_t n)
+{
+    static thread_local size_t counter = 0;
+    return counter++ % n;
+}
+
+// the first case from start on (wrapping around) that went ahead, or -1
+template<typename ... Cases>
+int try_cases(selector* self, bool locked, size_t start, Cases&... cases)
+{
+    int res = -1;
+    for(bool wrapped : {false, true})
+    {
+        size_t i = 0;
+        auto attempt = [&](auto& c){
+            if(res < 0 && (i >= start) != wrapped && c.try_commit(self, locked))
+            {
+                res = static_cast<int>(i);
+            }
+            ++i;
+        };
+        (attempt(cases), ...);
+    }
+    return res;
+}
+
+template<typename ... Cases>
+void run_case(int index, Cases&... cases)
+{
+    int i = 0;
+    ((i++ == index ? cases.run() : void()), ...);
+}
+} // namespace detail
+
+template<typename Channel, typename F>
+struct recv_case
+{
+    using value_type = typename Channel::value_type;
+    static constexpr bool is_send = false;
+
+    bool try_commit(detail::selector* self, bool locked)
+    {
+        return ch.try_recv(value, self, locked);
+    }
+    void run()
+    {
+        f(std::move(value));
+    }
+
+    Channel& ch;
+    F f;
+    std::optional<value_type> value{};
+};
+
+template<typename Channel, typename F>
+struct send_case
+{
+    using value_type = typename Channel::value_type;
+    static constexpr bool is_send = true;
+
+    bool try_commit(detail::selector* self, bool locked)
+    {
+        return ch.try_send(value, self, locked);
+    }
+    void run()
+    {
+        f();
+    }
+
+    Channel& ch;
+    F f;
+    std::optional<value_type> value;
+};
+
+// f(std::optional<T>) runs if this case fires: nullopt means ch is closed
+template<typename Channel, typename F>
+recv_case<Channel, F> on_recv(Channel& ch, F f)
+{
+    return {ch, std::move(f)};
+}
+
+// f() runs if this case fires, i.e. if value was sent
+template<typename Channel, typename U, typename F>
+send_case<Channel, F> on_send(Channel& ch, U&& value, F f)
+{
+    return {ch, std::move(f), std::optional<typename Channel::value_type>{std::forward<U>(value)}};
+}
+
+// -1 if no case can go ahead right now
+template<typename ... Cases>
+int try_select(Cases... cases)
+{
+    const int i = detail::try_cases(nullptr, false, detail::next_start(sizeof...(Cases)), cases...);
+    if(i >= 0)
+    {
+        detail::run_case(i, cases...);
+    }
+    return i;
+}
+
+template<typename ... Cases>
+int select(Cases... cases)
+{
+    detail::selector self;
+    detail::lock_set<sizeof...(Cases)> locks{{&cases.ch.mutex()...}};
+    const size_t start = detail::next_start(sizeof...(Cases));
+
+    while(true)
+    {
+        // nobody knows about us yet, so nobody can claim us
+        int i = detail::try_cases(&self, false, start, cases...);
+        if(i >= 0)
+        {
+            detail::run_case(i, cases...);
+            return i;
+        }
+
+        locks.lock();
+        self.reset();
+        int index = 0;
+        (cases.ch.enlist({&self, index++, Cases::is_send, &cases.value}), ...);
+
+        // anything that happened before we registered shows up here
+        i = detail::try_cases(&self, true, start, cases...);
+        if(i < 0)
+        {
+            locks.unlock();
+            self.park();
+            locks.lock();
+            i = self.fired.load();
+        }
+        (cases.ch.delist(&self), ...);
+        locks.unlock();
+
+        if(i >= 0)
+        {
+            detail::run_case(i, cases...);
+            return i;
+        }
+    }
+}
+
+/*
+    Unbuffered: a plain send / recv meets its partner in the synchronous queue
+    (waiters are served in arrival order, as in Go), or claims a blocked select.
+    close() releases the receivers waiting in the queue by handing each of them
+    an empty value.
+*/
+template<typename T>
+struct channel : detail::channel_core<T>
+{
+    using value_type = T;
+
+    void send(T item)
+    {
+        assert(!this->closed());
+        std::optional<T> x{std::move(item)};
+        if(give_to_select(x, nullptr, false))
+        {
+            return;
+        }
+        queue_.enq(std::move(x), [this](){ this->notify(false); });
+    }
+
+    // nullopt once the channel is closed
+    std::optional<T> recv()
+    {
+        std::optional<T> x;
+        if(take_from_select(x, nullptr, false))
+        {
+            return x;
+        }
+
+        ++receivers_;
+        if(this->closed())
+        {
+            --receivers_;
+            return std::nullopt;
+        }
+        x = queue_.deq([this](){ this->notify(false); });
+        --receivers_;
+        return x;
+    }
+
+    void close()
+    {
+        this->closed_.store(true);
+        this->notify(false);
+        // a receiver either sees closed_ or is counted and will queue up
+        while(receivers_.load() > 0)
+        {
+            if(!queue_.try_offer(std::optional<T>{}))
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // select hooks: item is only taken on success
+    bool try_send(std::optional<T>& item, detail::selector* self, bool locked)
+    {
+        assert(!this->closed());
+        return queue_.try_offer(std::move(item)) || give_to_select(item, self, locked);
+    }
+
+    bool try_recv(std::optional<T>& out, detail::selector* self, bool locked)
+    {
+        if(this->closed())
+        {
+            out.reset();
+            return true;
+        }
+        if(auto x = queue_.try_poll())
+        {
+            // an empty value is close() releasing us
+            out = std::move(*x);
+            return true;
+        }
+        return take_from_select(out, self, locked);
+    }
+
+private:
+    // claim a blocked select's recv case and hand it item
+    bool give_to_select(std::optional<T>& item, detail::selector* self, bool locked)
+    {
+        if(this->registered_.load() == 0)
+        {
+            return false;
+        }
+        std::unique_lock<std::mutex> lk{this->lock_, std::defer_lock};
+        if(!locked)
+        {
+            lk.lock();
+        }
+        for(auto& r : this->waiters_)
+        {
+            if(!r.isSend && r.sel != self && r.sel->claim(r.index))
+            {
+                *r.slot = std::move(item);
+                item.reset();
+                r.sel->wake();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // claim a blocked select's send case and take its value
+    bool take_from_select(std::optional<T>& out, detail::selector* self, bool locked)
+    {
+        if(this->registered_.load() == 0)
+        {
+            return false;
+        }
+        std::unique_lock<std::mutex> lk{this->lock_, std::defer_lock};
+        if(!locked)
+        {
+            lk.lock();
+        }
+        for(auto& r : this->waiters_)
+        {
+            if(r.isSend && r.sel != self && r.sel->claim(r.index))
+            {
+                out = std::move(*r.slot);
+                r.slot->reset();
+                r.sel->wake();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    SynchronousQueue<std::optional<T>, true> queue_;
+    std::atomic<size_t> receivers_{ 0 };
+};
+
+/*
+    Buffered: values go through the ring, so partners never meet directly. A
+    blocking send / recv is a select with a single case.
+*/
+template<typename T>
+struct buffered_channel : detail::channel_core<T>
+{
+    using value_type = T;
+
+    explicit buffered_channel(size_t capacity)
+        : ring_(capacity)
+    {}
+
+    void send(T item)
+    {
+        select(on_send(*this, std::move(item), [](){}));
+    }
+
+    // nullopt once the channel is closed and drained
+    std::optional<T> recv()
+    {
+        std::optional<T> res;
+        select(on_recv(*this, [&res](std::optional<T> x){ res = std::move(x); }));
+        return res;
+    }
+
+    void close()
+    {
+        this->closed_.store(true);
+        this->notify(false);
+    }
+
+    bool try_send(std::optional<T>& item, detail::selector*, bool locked)
+    {
+        assert(!this->closed());
+        // a failed enq leaves the value alone
+        if(!ring_.enq(std::move(*item)))
+        {
+            return false;
+        }
+        item.reset();
+        this->notify(locked);
+        return true;
+    }
+
+    bool try_recv(std::optional<T>& out, detail::selector*, bool locked)
+    {
+        out = ring_.deq();
+        if(!out)
+        {
+            if(!this->closed())
+            {
+                return false;
+            }
+            // every send finished before close, so this deq sees them all
+            out = ring_.deq();
+            if(!out)
+            {
+                return true;
+            }
+        }
+        this->notify(locked);
+        return true;
+    }
+
+private:
+    MRMWQueue<T> ring_;
+};
+} // namespace channels
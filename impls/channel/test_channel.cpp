@@ -0,0 +1,318 @@
+#include "channel.h"
+#include <cassert>
+#include <chrono>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+template<typename Channel>
+void ordered_test(Channel& ch)
+{
+    static constexpr int items = 10000;
+    std::thread producer([&ch](){
+        for(int i = 0; i < items; ++i)
+        {
+            ch.send(i);
+        }
+        ch.close();
+    });
+    for(int i = 0; i < items; ++i)
+    {
+        assert(ch.recv() == i);
+    }
+    assert(!ch.recv().has_value());
+    assert(!ch.recv().has_value());
+    producer.join();
+}
+
+void move_only_test()
+{
+    channels::channel<std::unique_ptr<int>> ch;
+    std::thread producer([&ch](){
+        ch.send(std::make_unique<int>(1));
+        channels::select(channels::on_send(ch, std::make_unique<int>(2), [](){}));
+    });
+    assert(*ch.recv().value() == 1);
+    channels::select(channels::on_recv(ch, [](std::optional<std::unique_ptr<int>> x){
+        assert(**x == 2);
+    }));
+    producer.join();
+}
+
+// receivers blocked on a channel, plain or in a select, are released by close
+void close_test()
+{
+    channels::channel<int> a;
+    channels::buffered_channel<int> b{4};
+    std::atomic<int> released{ 0 };
+    std::vector<std::thread> threads;
+
+    for(int i = 0; i < 2; ++i)
+    {
+        threads.emplace_back([&](){
+            assert(!a.recv().has_value());
+            ++released;
+        });
+        threads.emplace_back([&](){
+            assert(!b.recv().has_value());
+            ++released;
+        });
+        threads.emplace_back([&](){
+            channels::select(channels::on_recv(a, [](std::optional<int> x){ assert(!x); }),
+                    channels::on_recv(b, [](std::optional<int> x){ assert(!x); }));
+            ++released;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds{20});
+    assert(released.load() == 0);
+    a.close();
+    b.close();
+    for(auto& th : threads)
+    {
+        th.join();
+    }
+    assert(released.load() == 6);
+}
+
+void try_select_test()
+{
+    channels::channel<int> a;
+    channels::buffered_channel<int> b{1};
+    int got = -1;
+
+    assert(channels::try_select(channels::on_recv(a, [](std::optional<int>){}),
+                channels::on_recv(b, [](std::optional<int>){})) == -1);
+    assert(channels::try_select(channels::on_send(b, 5, [](){})) == 0);
+    // full now
+    assert(channels::try_select(channels::on_send(b, 6, [](){})) == -1);
+    assert(channels::try_select(channels::on_recv(a, [](std::optional<int>){}),
+                channels::on_recv(b, [&got](std::optional<int> x){ got = *x; })) == 1);
+    assert(got == 5);
+}
+
+/*
+    Fan in: every producer has its own channel (half of them unbuffered), one
+    consumer selects over all of them until they are all closed. Every value
+    arrives exactly once and in order per channel.
+*/
+void fan_in_test()
+{
+    static constexpr int per_producer = 5000;
+    channels::channel<int> u0, u1;
+    channels::buffered_channel<int> b0{8}, b1{8};
+    std::vector<std::thread> threads;
+
+    auto produce = [](auto& ch, int p){
+        return [&ch, p](){
+            for(int i = 0; i < per_producer; ++i)
+            {
+                ch.send(p * per_producer + i);
+            }
+            ch.close();
+        };
+    };
+    threads.emplace_back(produce(u0, 0));
+    threads.emplace_back(produce(u1, 1));
+    threads.emplace_back(produce(b0, 2));
+    threads.emplace_back(produce(b1, 3));
+
+    std::vector<int> next{0, 1 * per_producer, 2 * per_producer, 3 * per_producer};
+    std::vector<bool> closed(4);
+    int open = 4;
+    auto take = [&](int p){
+        return [&, p](std::optional<int> x){
+            if(!x)
+            {
+                open -= !closed[p];
+                closed[p] = true;
+                return;
+            }
+            assert(*x == next[p]);
+            ++next[p];
+        };
+    };
+    while(open > 0)
+    {
+        channels::select(channels::on_recv(u0, take(0)), channels::on_recv(u1, take(1)),
+                channels::on_recv(b0, take(2)), channels::on_recv(b1, take(3)));
+    }
+    for(int p = 0; p < 4; ++p)
+    {
+        assert(next[p] == (p + 1) * per_producer);
+    }
+    for(auto& th : threads)
+    {
+        th.join();
+    }
+}
+
+/*
+    A select that sends on one of two unbuffered channels must give away each
+    value exactly once, whether the receiver is a plain recv or another select
+    (which can only meet it through the registrations).
+*/
+void exactly_one_test()
+{
+    static constexpr int items = 5000;
+    channels::channel<int> a, b, idle;
+    std::vector<int> counts(items);
+    std::vector<std::thread> threads;
+
+    threads.emplace_back([&](){
+        for(int i = 0; i < items; ++i)
+        {
+            channels::select(channels::on_send(a, i, [](){}), channels::on_send(b, i, [](){}));
+        }
+        a.close();
+        b.close();
+    });
+    std::vector<std::vector<int>> seen(2);
+    threads.emplace_back([&](){
+        while(auto x = a.recv())
+        {
+            seen[0].push_back(*x);
+        }
+    });
+    threads.emplace_back([&](){
+        bool done = false;
+        while(!done)
+        {
+            channels::select(channels::on_recv(b, [&](std::optional<int> x){
+                        done = !x;
+                        if(x)
+                        {
+                            seen[1].push_back(*x);
+                        }
+                    }),
+                    channels::on_recv(idle, [](std::optional<int>){ assert(false); }));
+        }
+    });
+    for(auto& th : threads)
+    {
+        th.join();
+    }
+
+    for(auto& s : seen)
+    {
+        for(int x : s)
+        {
+            ++counts[x];
+        }
+    }
+    for(int c : counts)
+    {
+        assert(c == 1);
+    }
+}
+
+/*
+    Latency of a blocked select: the consumer selects over n channels, a pinger
+    sends on each in turn and waits for the consumer's ack. The baseline is the
+    polling loop we used to write: try every channel, yield, repeat.
+*/
+template<typename Channel, bool Polling>
+long long ns_per_wakeup(size_t n)
+{
+    static constexpr int rounds = 5000;
+    std::vector<std::unique_ptr<Channel>> chans;
+    for(size_t i = 0; i < n; ++i)
+    {
+        if constexpr(std::is_same_v<Channel, channels::channel<int>>)
+        {
+            chans.push_back(std::make_unique<Channel>());
+        }
+        else
+        {
+            chans.push_back(std::make_unique<Channel>(16));
+        }
+    }
+    channels::channel<int> ack;
+
+    auto start_time = std::chrono::steady_clock::now();
+    std::thread consumer([&](){
+        for(int r = 0; r < rounds; ++r)
+        {
+            std::optional<int> got;
+            if constexpr(Polling)
+            {
+                for(size_t i = 0; !got; i = (i + 1) % n)
+                {
+                    channels::try_select(channels::on_recv(*chans[i], [&got](std::optional<int> x){ got = x; }));
+                    if(i == n - 1)
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+            else
+            {
+                // n is a runtime value: select over a fixed 1 / 4 / 16 cases
+                auto recv = [&got](std::optional<int> x){ got = x; };
+                if(n == 1)
+                {
+                    channels::select(channels::on_recv(*chans[0], recv));
+                }
+                else if(n == 4)
+                {
+                    channels::select(channels::on_recv(*chans[0], recv), channels::on_recv(*chans[1], recv),
+                            channels::on_recv(*chans[2], recv), channels::on_recv(*chans[3], recv));
+                }
+                else
+                {
+                    assert(n == 16);
+                    auto& c = chans;
+                    channels::select(
+                            channels::on_recv(*c[0], recv), channels::on_recv(*c[1], recv),
+                            channels::on_recv(*c[2], recv), channels::on_recv(*c[3], recv),
+                            channels::on_recv(*c[4], recv), channels::on_recv(*c[5], recv),
+                            channels::on_recv(*c[6], recv), channels::on_recv(*c[7], recv),
+                            channels::on_recv(*c[8], recv), channels::on_recv(*c[9], recv),
+                            channels::on_recv(*c[10], recv), channels::on_recv(*c[11], recv),
+                            channels::on_recv(*c[12], recv), channels::on_recv(*c[13], recv),
+                            channels::on_recv(*c[14], recv), channels::on_recv(*c[15], recv));
+                }
+            }
+            ack.send(*got);
+        }
+    });
+    for(int r = 0; r < rounds; ++r)
+    {
+        chans[r % n]->send(r);
+        assert(ack.recv() == r);
+    }
+    consumer.join();
+    auto total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_time);
+
+    return (total_time / rounds).count();
+}
+
+void fan_in_benchmark()
+{
+    for(size_t n : {1, 4, 16})
+    {
+        std::cout << std::format("{} channels: unbuffered select {}ns, polling {}ns; buffered select {}ns, polling {}ns\n",
+                n,
+                ns_per_wakeup<channels::channel<int>, false>(n),
+                ns_per_wakeup<channels::channel<int>, true>(n),
+                ns_per_wakeup<channels::buffered_channel<int>, false>(n),
+                ns_per_wakeup<channels::buffered_channel<int>, true>(n));
+    }
+}
+
+int main()
+{
+    channels::channel<int> u;
+    ordered_test(u);
+    channels::buffered_channel<int> b{16};
+    ordered_test(b);
+    move_only_test();
+    close_test();
+    try_select_test();
+    fan_in_test();
+    exactly_one_test();
+
+    fan_in_benchmark();
+}
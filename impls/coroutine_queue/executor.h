@@ -0,0 +1,206 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "task.h"
+
+/*
+    Executors for the coroutine queues.
+
+    An executor only needs to know how to run a coroutine handle at some later
+    point (schedule). spawn starts a root task and keeps a count of the root
+    tasks that have not yet finished so callers can wait for quiescence.
+
+    inline_executor: everything runs on the thread that calls run().
+    thread_pool_executor: a fixed set of worker threads pulling from one queue.
+
+    The ready queue is a plain locked deque - the point of these is to test the
+    queues, not to be fast themselves.
+*/
+struct executor
+{
+    virtual ~executor() = default;
+
+    virtual void schedule(std::coroutine_handle<> h) = 0;
+
+    void spawn(task<void> t)
+    {
+        outstanding_.fetch_add(1, std::memory_order_relaxed);
+        schedule(run_detached(this, std::move(t)).h);
+    }
+
+protected:
+    virtual void task_finished() = 0;
+
+    size_t outstanding() const
+    {
+        return outstanding_.load(std::memory_order_acquire);
+    }
+
+    // returns true if that was the last outstanding task
+    bool finish_one()
+    {
+        return outstanding_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+private:
+    /*
+        Owns a root task: awaits it (so the task is handed this executor) and
+        destroys itself when done.
+    */
+    struct detached
+    {
+        struct promise_type
+        {
+            promise_type(executor* self, task<void>&)
+                : exec(self)
+            {}
+            detached get_return_object()
+            {
+                return {std::coroutine_handle<promise_type>::from_promise(*this)};
+            }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+
+            executor* exec;
+        };
+        std::coroutine_handle<promise_type> h;
+    };
+
+    static detached run_detached(executor* self, task<void> t)
+    {
+        co_await t;
+        self->task_finished();
+    }
+
+    std::atomic<size_t> outstanding_{ 0 };
+};
+
+struct inline_executor : executor
+{
+    void schedule(std::coroutine_handle<> h) override
+    {
+        std::unique_lock<std::mutex> lk{mtx_};
+        ready_.push_back(h);
+        cv_.notify_one();
+    }
+
+    /*
+        Runs until every spawned task has finished. Tasks may be parked on a
+        queue that another thread will make progress on, so an empty ready
+        queue only means we sleep.
+    */
+    void run()
+    {
+        std::unique_lock<std::mutex> lk{mtx_};
+        while(outstanding() > 0)
+        {
+            cv_.wait(lk, [this](){ return !ready_.empty() || outstanding() == 0; });
+
+            while(!ready_.empty())
+            {
+                auto h = ready_.front();
+                ready_.pop_front();
+                lk.unlock();
+                h.resume();
+                lk.lock();
+            }
+        }
+    }
+
+protected:
+    void task_finished() override
+    {
+        if(finish_one())
+        {
+            std::unique_lock<std::mutex> lk{mtx_};
+            cv_.notify_all();
+        }
+    }
+
+private:
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::deque<std::coroutine_handle<>> ready_;
+};
+
+struct thread_pool_executor : executor
+{
+    explicit thread_pool_executor(size_t num_threads)
+    {
+        for(size_t i = 0; i < num_threads; ++i)
+        {
+            workers_.emplace_back([this](){ work(); });
+        }
+    }
+
+    void schedule(std::coroutine_handle<> h) override
+    {
+        std::unique_lock<std::mutex> lk{mtx_};
+        ready_.push_back(h);
+        cv_.notify_one();
+    }
+
+    // blocks until every spawned task has finished
+    void wait()
+    {
+        std::unique_lock<std::mutex> lk{mtx_};
+        idle_cv_.wait(lk, [this](){ return outstanding() == 0; });
+    }
+
+    ~thread_pool_executor()
+    {
+        wait();
+        {
+            std::unique_lock<std::mutex> lk{mtx_};
+            stop_ = true;
+            cv_.notify_all();
+        }
+        for(auto& th : workers_)
+        {
+            th.join();
+        }
+    }
+
+protected:
+    void task_finished() override
+    {
+        if(finish_one())
+        {
+            std::unique_lock<std::mutex> lk{mtx_};
+            idle_cv_.notify_all();
+        }
+    }
+
+private:
+    void work()
+    {
+        std::unique_lock<std::mutex> lk{mtx_};
+        while(true)
+        {
+            cv_.wait(lk, [this](){ return stop_ || !ready_.empty(); });
+            if(ready_.empty())
+            {
+                return;
+            }
+            auto h = ready_.front();
+            ready_.pop_front();
+            lk.unlock();
+            h.resume();
+            lk.lock();
+        }
+    }
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::condition_variable idle_cv_;
+    std::deque<std::coroutine_handle<>> ready_;
+    bool stop_ = false;
+    std::vector<std::thread> workers_;
+};
@@ -0,0 +1,134 @@
+#pragma once
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+/*
+    Lazy coroutine task.
+
+    A task does nothing until it is awaited. Awaiting it hands the child the
+    executor of the parent (so anything deep in the call chain that parks itself
+    knows where it should be rescheduled) and then transfers control straight
+    into the child. When the child finishes it transfers straight back to the
+    parent: no executor round trip for plain nested calls.
+
+    Root tasks are started with executor::spawn.
+*/
+
+struct executor;
+
+template<typename T>
+struct task;
+
+namespace detail
+{
+struct promise_base
+{
+    struct final_awaiter
+    {
+        bool await_ready() noexcept { return false; }
+
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+        {
+            auto continuation = h.promise().continuation;
+            if(continuation)
+            {
+                return continuation;
+            }
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { std::terminate(); }
+
+    executor* exec = nullptr;
+    std::coroutine_handle<> continuation = nullptr;
+};
+
+template<typename T>
+struct promise : promise_base
+{
+    task<T> get_return_object();
+
+    template<typename U>
+    void return_value(U&& value)
+    {
+        result.emplace(std::forward<U>(value));
+    }
+
+    std::optional<T> result;
+};
+
+template<>
+struct promise<void> : promise_base
+{
+    task<void> get_return_object();
+    void return_void() {}
+};
+} // namespace detail
+
+template<typename T = void>
+struct [[nodiscard]] task
+{
+    using promise_type = detail::promise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    explicit task(handle_type h)
+        : h_(h)
+    {}
+    task(task&& other) noexcept
+        : h_(std::exchange(other.h_, nullptr))
+    {}
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+
+    ~task()
+    {
+        if(h_)
+        {
+            h_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    template<typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> parent) noexcept
+    {
+        h_.promise().exec = parent.promise().exec;
+        h_.promise().continuation = parent;
+        return h_;
+    }
+
+    T await_resume()
+    {
+        if constexpr(!std::is_void_v<T>)
+        {
+            return std::move(*h_.promise().result);
+        }
+    }
+
+    handle_type release()
+    {
+        return std::exchange(h_, nullptr);
+    }
+
+private:
+    handle_type h_;
+};
+
+template<typename T>
+task<T> detail::promise<T>::get_return_object()
+{
+    return task<T>{std::coroutine_handle<promise<T>>::from_promise(*this)};
+}
+
+inline task<void> detail::promise<void>::get_return_object()
+{
+    return task<void>{std::coroutine_handle<promise<void>>::from_promise(*this)};
+}
@@ -0,0 +1,116 @@
+#include "../mrmw_queue/mrmw_queue.h"
+#include "executor.h"
+#include <chrono>
+#include <format>
+
+task<void> producer(MRMWQueue<int>& q, int from, int to)
+{
+    for(int i = from; i < to; ++i)
+    {
+        co_await q.async_enq(i);
+    }
+}
+
+task<void> ordered_consumer(MRMWQueue<int>& q, int count)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        int x = co_await q.async_deq();
+        assert(x == i);
+    }
+}
+
+task<void> summing_consumer(MRMWQueue<int>& q, int count, std::atomic<long>& sum)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        sum.fetch_add(co_await q.async_deq());
+    }
+}
+
+void single_threaded_test()
+{
+    MRMWQueue<int> q(4);
+    inline_executor exec;
+
+    exec.spawn(ordered_consumer(q, 10000));
+    exec.spawn(producer(q, 0, 10000));
+    exec.run();
+
+    assert(q.empty());
+}
+
+void multi_threaded_test()
+{
+    static constexpr int producers = 8, consumers = 8, per_coroutine = 10000;
+    MRMWQueue<int> q(16);
+    std::atomic<long> sum{ 0 };
+    {
+        thread_pool_executor exec(4);
+        for(int i = 0; i < consumers; ++i)
+        {
+            exec.spawn(summing_consumer(q, per_coroutine, sum));
+        }
+        for(int i = 0; i < producers; ++i)
+        {
+            exec.spawn(producer(q, i * per_coroutine, (i + 1) * per_coroutine));
+        }
+    }
+
+    long n = producers * per_coroutine;
+    assert(sum.load() == n * (n - 1) / 2);
+    assert(q.empty());
+}
+
+task<void> ping(MRMWQueue<int>& out, MRMWQueue<int>& in, int rounds)
+{
+    for(int i = 0; i < rounds; ++i)
+    {
+        co_await out.async_enq(i);
+        int x = co_await in.async_deq();
+        assert(x == i);
+    }
+}
+
+task<void> pong(MRMWQueue<int>& in, MRMWQueue<int>& out, int rounds)
+{
+    for(int i = 0; i < rounds; ++i)
+    {
+        co_await out.async_enq(co_await in.async_deq());
+    }
+}
+
+/*
+    Two coroutines bouncing one value between two queues of capacity 1, so
+    every hop is a park on one side and a wake on the other.
+*/
+template<typename Executor, typename Run>
+void ping_pong_benchmark(const char* name, Executor& exec, Run&& run)
+{
+    static constexpr int rounds = 100000;
+    MRMWQueue<int> there(1), back(1);
+
+    auto start_time = std::chrono::steady_clock::now();
+    exec.spawn(ping(there, back, rounds));
+    exec.spawn(pong(there, back, rounds));
+    run();
+    auto end_time = std::chrono::steady_clock::now();
+
+    auto total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time);
+    std::cout << std::format("{}: {}ns per round trip\n", name, (total_time / rounds).count());
+}
+
+int main()
+{
+    single_threaded_test();
+    multi_threaded_test();
+
+    {
+        inline_executor exec;
+        ping_pong_benchmark("inline executor", exec, [&exec](){ exec.run(); });
+    }
+    {
+        thread_pool_executor exec(2);
+        ping_pong_benchmark("2 thread pool", exec, [&exec](){ exec.wait(); });
+    }
+}
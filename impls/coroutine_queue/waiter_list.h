@@ -0,0 +1,110 @@
+#pragma once
+#include <atomic>
+#include <coroutine>
+#include "executor.h"
+
+/*
+    Lock-free list of parked coroutines.
+
+    A waiter is a Treiber stack node that lives inside the awaiting coroutine's
+    frame, so parking never allocates. Waking is "wake everybody": the waker
+    swaps the whole list out with one exchange and reschedules each coroutine on
+    the executor it was running on. A woken coroutine simply retries its
+    operation and parks again if it lost the race, so we never need to unlink a
+    single node (the hard part of a lock-free waiter list).
+
+    The lost wakeup problem: a coroutine parks because the queue looked full,
+    then a consumer frees a slot and finds no waiters before the park lands.
+    Both sides are a Dekker style "store then load":
+
+        parker: push self (seq_cst)    -> re-check the queue (seq_cst)
+        waker : publish slot (seq_cst) -> load list head (seq_cst)
+
+    so at least one of them sees the other. If the parker's re-check succeeds it
+    wakes the list itself (itself included) rather than trying to back out.
+
+    The publishing store in the queue must therefore be seq_cst.
+*/
+struct waiter_list
+{
+    struct waiter
+    {
+        std::coroutine_handle<> h;
+        executor* exec;
+        waiter* next;
+    };
+
+    template<typename Recheck>
+    struct park_awaitable
+    {
+        bool await_ready() const noexcept { return false; }
+
+        template<typename Promise>
+        void await_suspend(std::coroutine_handle<Promise> h)
+        {
+            node_.h = h;
+            node_.exec = h.promise().exec;
+
+            // after the push we may be resumed (and this awaitable destroyed)
+            // on another thread at any moment: only touch locals from here on
+            waiter_list& list = list_;
+            Recheck recheck = recheck_;
+            list.push(&node_);
+
+            if(recheck())
+            {
+                list.wake_all();
+            }
+        }
+        void await_resume() const noexcept {}
+
+        waiter_list& list_;
+        Recheck recheck_;
+        waiter node_{};
+    };
+
+    /*
+        co_await list.park(recheck) suspends the caller until the next wake_all.
+        recheck is evaluated after the caller is on the list and should return
+        true if the operation it is waiting for might now succeed.
+    */
+    template<typename Recheck>
+    park_awaitable<Recheck> park(Recheck recheck)
+    {
+        return {*this, std::move(recheck)};
+    }
+
+    void wake_all()
+    {
+        if(head_.load() == nullptr)
+        {
+            return;
+        }
+
+        waiter* curr = head_.exchange(nullptr);
+        while(curr)
+        {
+            // once scheduled the frame (and so the node) may disappear
+            waiter* next = curr->next;
+            curr->exec->schedule(curr->h);
+            curr = next;
+        }
+    }
+
+    bool empty() const
+    {
+        return head_.load() == nullptr;
+    }
+
+private:
+    void push(waiter* w)
+    {
+        waiter* localHead = head_.load();
+        do
+        {
+            w->next = localHead;
+        } while(!head_.compare_exchange_weak(localHead, w));
+    }
+
+    std::atomic<waiter*> head_{ nullptr };
+};
@@ -1,116 +1,241 @@
-#include <atomic>
-#include <format>
+#include "dual_stack.h"
+#include "../lock_free_stack/lock_free_stack.h"
 #include "../../exercises/chapter10/test_pool.h"
+#include <cassert>
+#include <chrono>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
 
-template<typename T>
-struct stack_traits
+// test_pool expects a deq that gives up on an empty pool
+struct polling_view
 {
-    static T empty_value();
-};
-template<>
-struct stack_traits<int>
-{
-    static int empty_value()
+    bool enq(int x)
+    {
+        return S.enq(x);
+    }
+    std::optional<int> deq()
+    {
+        return S.try_deq();
+    }
+    bool empty()
     {
-        return -1;
+        return S.empty();
     }
+
+    dual_stack<int>& S;
 };
 
-int int_fetch_add(std::atomic<int>& x, const int oper)
+/*
+    Consumers first, so most values go straight into reservations: every value
+    still arrives exactly once.
+*/
+void reservation_test()
 {
-    int localCopy = x.load(std::memory_order_acquire);
-
-    while(!x.compare_exchange_weak(localCopy, localCopy + oper));
+    static constexpr int per_producer = 10000;
 
-    return localCopy;
+    dual_stack<int> S(64);
+    producer_consumer_test(4, 8, per_producer,
+        [&S](int p){
+            for(int i = 0; i < per_producer; ++i)
+            {
+                while(!S.enq(p * per_producer + i))
+                {
+                    std::this_thread::yield();
+                }
+            }
+        },
+        [&S](int, std::vector<int>& out){
+            out.push_back(S.deq());
+        },
+        drain_mode::equal_shares);
+    assert(S.empty());
 }
-template<typename T>
-struct dual_stack
+
+// parked consumers are served latest first, like the values
+void lifo_test()
 {
-    dual_stack(int capacity)
-        :  capacity{capacity}, head{0}, items{static_cast<size_t>(capacity)}
+    static constexpr int consumers = 4;
+    dual_stack<int> S(16);
+    std::vector<int> got(consumers, -1);
+    std::vector<std::thread> threads;
+
+    for(int c = 0; c < consumers; ++c)
+    {
+        threads.emplace_back([&S, &got, c](){
+            got[c] = S.deq();
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+    }
+    for(int i = 0; i < consumers; ++i)
+    {
+        assert(S.enq(i));
+    }
+    for(auto& th : threads)
+    {
+        th.join();
+    }
+    for(int c = 0; c < consumers; ++c)
     {
+        assert(got[c] == consumers - 1 - c);
     }
 
-    template<typename ... Args>
-    bool enq(Args&&... args)
+    for(int i = 0; i < consumers; ++i)
     {
-        while(true)
-        {
-            int index = int_fetch_add(head, 1);
+        assert(S.enq(i));
+    }
+    for(int i = consumers - 1; i >= 0; --i)
+    {
+        assert(S.try_deq() == i);
+    }
+    assert(!S.try_deq().has_value());
+}
 
-            if(index >= capacity)
-            {
-                std::cout << std::format("full: {}\n", index);
-                return false;
-            }
-            else if(index > 1)
+// the stack grows far past its initial chunk and hands the extra back
+void growth_test()
+{
+    static constexpr int items = 5000;
+    dual_stack<std::unique_ptr<int>> S(1);
+    const size_t initial = S.capacity();
+
+    for(int i = 0; i < items; ++i)
+    {
+        assert(S.enq(std::make_unique<int>(i)));
+    }
+    assert(S.capacity() >= items);
+    for(int i = items - 1; i >= 0; --i)
+    {
+        assert(*S.deq() == i);
+    }
+    assert(S.empty());
+    assert(S.capacity() == initial);
+}
+
+/*
+    Bursts: every thread pushes a few thousand values and pops as many, so the
+    pool keeps growing and shrinking under the concurrent operations. Every
+    value still arrives exactly once.
+*/
+void burst_test()
+{
+    static constexpr int threads_count = 4;
+    static constexpr int bursts = 20;
+    static constexpr int burst = 2000;
+
+    dual_stack<int> S(1);
+    std::vector<std::vector<int>> seen(threads_count);
+    std::vector<std::thread> threads;
+
+    for(int t = 0; t < threads_count; ++t)
+    {
+        threads.emplace_back([&S, &seen, t](){
+            for(int b = 0; b < bursts; ++b)
             {
-                while(items[index].filled.load())
+                for(int i = 0; i < burst; ++i)
                 {
-                    std::cout << std::format("enq spinning on {}\n", index);
+                    assert(S.enq((t * bursts + b) * burst + i));
+                }
+                for(int i = 0; i < burst; ++i)
+                {
+                    seen[t].push_back(S.deq());
                 }
-
-                new (&items[index].item) T{std::forward<Args>(args)...};
-                items[index].filled.store(true);
-                std::cout << std::format("enq successful {}\n", index);
-                return true;
             }
-        }
+        });
     }
-    std::optional<T> deq()
+    for(auto& th : threads)
     {
-        /* std::cout << "deq initiated\n"; */
-        if(head.load() <= 0)
-        {
-            return std::nullopt;
-        }
+        th.join();
+    }
 
-        while(true)
-        {
-            int index = int_fetch_add(head, -1);
+    assert_exactly_once(seen, threads_count * bursts * burst);
+}
+
+/*
+    Consumer heavy mix: four consumers per producer. The dual stack's consumers
+    wait on their own reservation; the Treiber stack's can only retry.
+*/
+template<typename Stack>
+long long ns_per_item(size_t producers)
+{
+    static constexpr size_t total = 1 << 16;
+    const size_t consumers = 4 * producers;
+    const size_t per_producer = total / producers;
+    const size_t per_consumer = total / consumers;
 
-            if(index <= 0)
+    std::unique_ptr<Stack> S;
+    if constexpr(std::is_same_v<Stack, dual_stack<int>>)
+    {
+        S = std::make_unique<Stack>(1024);
+    }
+    else
+    {
+        S = std::make_unique<Stack>();
+    }
+    std::vector<std::thread> threads;
+
+    auto start_time = std::chrono::steady_clock::now();
+    for(size_t c = 0; c < consumers; ++c)
+    {
+        threads.emplace_back([&S, per_consumer](){
+            for(size_t i = 0; i < per_consumer; ++i)
             {
-                /* std::cout << std::format("deq failed: empty: {}\n", index); */
-                return std::nullopt;
+                if constexpr(std::is_same_v<Stack, dual_stack<int>>)
+                {
+                    S->deq();
+                }
+                else
+                {
+                    while(!S->deq())
+                    {
+                        std::this_thread::yield();
+                    }
+                }
             }
-            else if(index <= capacity)
+        });
+    }
+    for(size_t p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&S, per_producer](){
+            for(size_t i = 0; i < per_producer; ++i)
             {
-                while(!items[index].filled.load())
+                while(!S->enq(static_cast<int>(i)))
                 {
-                    /* std::cout << std::format("deq spinning on index {}\n", index - 1); */
+                    std::this_thread::yield();
                 }
-
-                T res = std::move(items[index].item);
-                items[index - 1].item.~T();
-                items[index - 1].filled.store(false);
-                /* std::cout << std::format("deq successful of {}\n", index - 1); */
-                return res;
             }
-        }
+        });
     }
-    bool empty()
+    for(auto& th : threads)
     {
-        return head.load(std::memory_order_acquire) <= 0;
+        th.join();
     }
-private:
-    struct node
-    {
-        node() : item{stack_traits<T>::empty_value()}, filled{false}
-        {}
-        T item;
-        std::atomic<bool> filled;
-    };
+    auto total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_time);
 
-    const int capacity;
-    std::atomic<int> head;
-    std::vector<node> items;
-};
+    return (total_time / total).count();
+}
+
+void benchmark()
+{
+    for(size_t producers = 1; producers <= 4; producers *= 2)
+    {
+        std::cout << std::format("{} producers / {} consumers: dual stack {}ns/item, treiber stack {}ns/item\n",
+                producers, 4 * producers,
+                ns_per_item<dual_stack<int>>(producers),
+                ns_per_item<lock_free_stack<int>>(producers));
+    }
+}
 
 int main()
 {
     dual_stack<int> S(1000);
-    test_pool(S);
-}
+    test_pool(polling_view{S});
+    reservation_test();
+    lifo_test();
+    growth_test();
+    burst_test();
 
+    benchmark();
+}
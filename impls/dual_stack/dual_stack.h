@@ -0,0 +1,279 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include "../synchronous_queue/synchronous_queue.h"
+#include "segmented_pool.h"
+
+/*
+    Lock-free dual stack (Scherer and Scott 2004) over a pool of indexed nodes.
+
+    The stack holds either data (values nobody has asked for yet) or
+    reservations (deqs waiting for a value), never both:
+
+    enq: if the top is a reservation, pop it - winning that CAS is what claims
+         it - put the value in it and wake its owner. Otherwise push a data
+         node. enq never waits.
+
+    deq: if the top is data, pop it and take the value. Otherwise push a
+         reservation and wait on it until an enq fills it in. The waiting is
+         the synchronous queue's: spin while we are on top (the next enq is
+         ours), then park on the node's own condition variable.
+
+    Claiming a reservation is the same CAS as popping it, so nothing can ever
+    be pushed over a claimed reservation and we need no "fulfilling" nodes.
+
+    Nodes are named by 32 bit index. head_ packs the top index with a 32 bit
+    stamp that every successful CAS bumps, so a node that was popped, freed and
+    reused cannot fool a stale CAS (ABA).
+
+    The nodes come from a segmented_pool, which grows a chunk at a time while
+    everybody carries on and hands empty chunks back once the stack has shrunk
+    well below its peak, so memory follows the live depth. Reading the top
+    node goes through the pool's protect() (a hazard pointer on its chunk,
+    slot 0) followed by re-checking head_: if head_ has not moved the node is
+    still on the stack, so its chunk cannot have been returned. Reading a node
+    that has just been recycled is otherwise harmless - the CAS that follows
+    fails. An enq keeps the reservation it claimed protected until it has
+    finished waking the owner.
+
+    The constructor's argument is the number of nodes to start with (rounded up
+    to whole chunks), which are never returned. enq only fails if the pool hits
+    its 2^24 node limit.
+*/
+template<typename T>
+struct dual_stack
+{
+    explicit dual_stack(uint32_t initialNodes)
+        : pool_(initialNodes)
+    {}
+
+    dual_stack(const dual_stack&) = delete;
+    dual_stack& operator=(const dual_stack&) = delete;
+
+    template<typename ... Args>
+    bool enq(Args&&... args)
+    {
+        hazard::guard gTop{0};
+        uint32_t d = nil;
+
+        while(true)
+        {
+            uint64_t h = head_.load();
+            node* t;
+            if(!protect_top(h, gTop, t))
+            {
+                continue;
+            }
+
+            if(t != nullptr && !t->isData.load(std::memory_order_relaxed))
+            {
+                if(!pop(h, t))
+                {
+                    continue;
+                }
+                node& r = *t;
+                if(d != nil)
+                {
+                    // built a data node on an earlier lap
+                    r.value = std::move(pool_[d].value);
+                    pool_[d].value.reset();
+                    pool_.release(d);
+                }
+                else
+                {
+                    r.value.emplace(std::forward<Args>(args)...);
+                }
+                detail::wake(&r);
+                return true;
+            }
+
+            if(d == nil)
+            {
+                d = pool_.acquire();
+                if(d == nil)
+                {
+                    return false;
+                }
+                pool_[d].value.emplace(std::forward<Args>(args)...);
+                pool_[d].isData.store(true, std::memory_order_relaxed);
+            }
+            if(push(h, d))
+            {
+                return true;
+            }
+        }
+    }
+
+    T deq()
+    {
+        hazard::guard gTop{0};
+        uint32_t r = nil;
+
+        while(true)
+        {
+            uint64_t h = head_.load();
+            node* t;
+            if(!protect_top(h, gTop, t))
+            {
+                continue;
+            }
+
+            if(t != nullptr && t->isData.load(std::memory_order_relaxed))
+            {
+                if(pop(h, t))
+                {
+                    if(r != nil)
+                    {
+                        pool_.release(r);
+                    }
+                    return take(index(h));
+                }
+                continue;
+            }
+
+            if(r == nil)
+            {
+                r = pool_.acquire();
+                if(r == nil)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+                node& n = pool_[r];
+                n.isData.store(false, std::memory_order_relaxed);
+                n.state.store(detail::waiting, std::memory_order_relaxed);
+                n.parked.store(false, std::memory_order_relaxed);
+            }
+            if(push(h, r))
+            {
+                gTop.clear();
+                detail::await_done(&pool_[r], [this, r](){ return index(head_.load()) == r; },
+                        spin_, std::nullopt);
+                return take(r);
+            }
+        }
+    }
+
+    // never waits: nullopt unless a value is on top
+    std::optional<T> try_deq()
+    {
+        hazard::guard gTop{0};
+
+        while(true)
+        {
+            uint64_t h = head_.load();
+            node* t;
+            if(!protect_top(h, gTop, t))
+            {
+                continue;
+            }
+
+            if(t == nullptr || !t->isData.load(std::memory_order_relaxed))
+            {
+                return std::nullopt;
+            }
+            if(pop(h, t))
+            {
+                return take(index(h));
+            }
+        }
+    }
+
+    // no values waiting (there may be reservations)
+    bool empty() const
+    {
+        hazard::guard gTop{0};
+
+        while(true)
+        {
+            uint64_t h = head_.load();
+            node* t;
+            if(protect_top(h, gTop, t))
+            {
+                return t == nullptr || !t->isData.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // nodes currently allocated for the stack, free ones included
+    size_t capacity() const
+    {
+        return pool_.capacity();
+    }
+
+private:
+    struct node
+    {
+        std::optional<T> value;
+        std::atomic<bool> isData{ false };
+        std::atomic<uint32_t> next{ nil };
+
+        // reservations only: see detail::await_done
+        std::atomic<int> state{ detail::waiting };
+        std::atomic<bool> parked{ false };
+        std::mutex parkLock;
+        std::condition_variable parkCv;
+    };
+
+    static uint64_t pack(uint32_t i, uint32_t stamp)
+    {
+        return static_cast<uint64_t>(stamp) << 32 | i;
+    }
+    static uint32_t index(uint64_t word)
+    {
+        return static_cast<uint32_t>(word);
+    }
+    static uint32_t stamp(uint64_t word)
+    {
+        return static_cast<uint32_t>(word >> 32);
+    }
+
+    using pool = segmented_pool<node>;
+    static constexpr uint32_t nil = pool::nil;
+
+    /*
+        t becomes the top node of h (nullptr if the stack is empty), safe to
+        read until g moves on. False if head_ has moved since h was read.
+    */
+    bool protect_top(uint64_t h, hazard::guard& g, node*& t) const
+    {
+        t = nullptr;
+        if(index(h) == nil)
+        {
+            return true;
+        }
+        t = pool_.protect(index(h), g);
+        return t != nullptr && head_.load() == h;
+    }
+
+    // t is the top of h: it is ours if this succeeds
+    bool pop(uint64_t h, node* t)
+    {
+        uint32_t next = t->next.load(std::memory_order_relaxed);
+        return head_.compare_exchange_strong(h, pack(next, stamp(h) + 1));
+    }
+
+    bool push(uint64_t h, uint32_t i)
+    {
+        pool_[i].next.store(index(h), std::memory_order_relaxed);
+        return head_.compare_exchange_strong(h, pack(i, stamp(h) + 1));
+    }
+
+    T take(uint32_t i)
+    {
+        T res = std::move(*pool_[i].value);
+        pool_[i].value.reset();
+        pool_.release(i);
+        return res;
+    }
+
+    static constexpr size_t cacheLineSize = 64;
+
+    pool pool_;
+    alignas(cacheLineSize) std::atomic<uint64_t> head_{ pack(nil, 0) };
+    detail::adaptive_spin spin_;
+};
@@ -0,0 +1,321 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include "../hazard_pointer/hazard_pointer.h"
+
+/*
+    Growable pool of nodes named by 32 bit index, for index based lock-free
+    structures.
+
+    Nodes live in chunks of chunk_size that never move once allocated. An
+    index splits into three fields:
+
+        [ directory : 8 | leaf : 8 | node : 8 ]
+
+    The directory is a fixed array of pointers to leaves, a leaf a fixed array
+    of pointers to chunks, and both levels are filled in lazily with a CAS, so
+    growing never stops or moves anybody: a thread that runs out of free nodes
+    installs a fresh chunk in the lowest empty slot and carries on.
+
+    Every chunk keeps its own free list, a stack threaded through Node::next
+    (which must be a std::atomic<uint32_t>), packed with a count and a stamp
+    into one word. acquire prefers the lowest chunk with a free node, so the
+    live nodes pile up at the bottom and the top chunks drain during quiet
+    spells.
+
+    Low watermark: whenever a chunk drains completely we sweep the pool from
+    the top, returning free chunks for as long as the live nodes would fill at
+    most half of what is left. A chunk is returned by closing it (one CAS on
+    its free word, valid only while all chunk_size nodes are free), unlinking
+    it and retiring it through hazard pointers. The chunks the pool started
+    with are never returned.
+
+    Reading a node somebody else might free takes protect(): it publishes the
+    node's chunk in a hazard slot. The caller must then re-check that the node
+    is still live (e.g. still reachable from its structure) - a chunk is only
+    retired once none of its nodes are, so after that check the memory stays
+    put until the guard moves on. Nodes the caller owns need no protection.
+*/
+template<typename Node>
+struct segmented_pool
+{
+    static constexpr uint32_t nil = UINT32_MAX;
+    static constexpr uint32_t chunk_bits = 8;
+    static constexpr uint32_t leaf_bits = 8;
+    static constexpr uint32_t dir_bits = 8;
+    static constexpr uint32_t chunk_size = 1u << chunk_bits;
+    static constexpr uint32_t max_chunks = 1u << (leaf_bits + dir_bits);
+
+    explicit segmented_pool(uint32_t initialNodes)
+        : pinned_((initialNodes + chunk_size - 1) / chunk_size)
+    {
+        for(uint32_t k = 0; k < pinned_; ++k)
+        {
+            grow();
+        }
+    }
+
+    segmented_pool(const segmented_pool&) = delete;
+    segmented_pool& operator=(const segmented_pool&) = delete;
+
+    // nil only once all max_chunks chunks are in use
+    uint32_t acquire()
+    {
+        hazard::guard g{1};
+
+        while(true)
+        {
+            const uint32_t chunks = highWater_.load();
+            const uint32_t start = std::min(hint_.load(std::memory_order_relaxed), chunks);
+            for(uint32_t j = 0; j < chunks; ++j)
+            {
+                uint32_t k = (start + j) % chunks;
+                chunk* c = protect_chunk(k, g);
+                if(c == nullptr)
+                {
+                    continue;
+                }
+                uint32_t i = pop_free(*c, k);
+                if(i != nil)
+                {
+                    hint_.store(k, std::memory_order_relaxed);
+                    live_.fetch_add(1);
+                    return i;
+                }
+            }
+            if(!grow())
+            {
+                return nil;
+            }
+        }
+    }
+
+    void release(uint32_t i)
+    {
+        hazard::guard g{1};
+        const uint32_t k = i >> chunk_bits;
+        // we own i, so its chunk is installed
+        chunk* c = protect_chunk(k, g);
+
+        const uint32_t freeNodes = push_free(*c, i);
+        live_.fetch_sub(1);
+        if(k < hint_.load(std::memory_order_relaxed))
+        {
+            hint_.store(k, std::memory_order_relaxed);
+        }
+
+        if(freeNodes == chunk_size)
+        {
+            g.clear();
+            sweep(g);
+        }
+    }
+
+    // nodes the caller owns
+    Node& operator[](uint32_t i) const
+    {
+        return chunk_of(i >> chunk_bits)->nodes[i & chunk_mask];
+    }
+
+    // see above: the caller re-checks that i is still live before trusting it
+    Node* protect(uint32_t i, hazard::guard& g) const
+    {
+        chunk* c = protect_chunk(i >> chunk_bits, g);
+        return c ? &c->nodes[i & chunk_mask] : nullptr;
+    }
+
+    // nodes in installed chunks
+    size_t capacity() const
+    {
+        return capacity_.load();
+    }
+
+    size_t live() const
+    {
+        return live_.load();
+    }
+
+    ~segmented_pool()
+    {
+        for(auto& l : dir_)
+        {
+            leaf* lf = l.load();
+            if(lf == nullptr)
+            {
+                continue;
+            }
+            for(auto& s : lf->slots)
+            {
+                delete s.load();
+            }
+            delete lf;
+        }
+    }
+
+private:
+    static constexpr uint32_t chunk_mask = chunk_size - 1;
+    static constexpr uint32_t leaf_mask = (1u << leaf_bits) - 1;
+    static constexpr uint32_t local_nil = 0xFFFF;
+
+    struct chunk
+    {
+        Node nodes[chunk_size];
+        // [ stamp : 32 | free count : 16 | head : 16 ]
+        std::atomic<uint64_t> free;
+    };
+
+    struct leaf
+    {
+        std::atomic<chunk*> slots[1u << leaf_bits]{};
+    };
+
+    static uint64_t pack(uint32_t head, uint32_t count, uint32_t stamp)
+    {
+        return static_cast<uint64_t>(stamp) << 32 | count << 16 | head;
+    }
+    static uint32_t head_of(uint64_t w)
+    {
+        return w & 0xFFFF;
+    }
+    static uint32_t count_of(uint64_t w)
+    {
+        return (w >> 16) & 0xFFFF;
+    }
+    static uint32_t stamp_of(uint64_t w)
+    {
+        return static_cast<uint32_t>(w >> 32);
+    }
+
+    chunk* chunk_of(uint32_t k) const
+    {
+        leaf* lf = dir_[k >> leaf_bits].load();
+        return lf ? lf->slots[k & leaf_mask].load() : nullptr;
+    }
+
+    chunk* protect_chunk(uint32_t k, hazard::guard& g) const
+    {
+        leaf* lf = dir_[k >> leaf_bits].load();
+        return lf ? g.protect(lf->slots[k & leaf_mask]) : nullptr;
+    }
+
+    leaf& leaf_for(uint32_t k)
+    {
+        auto& l = dir_[k >> leaf_bits];
+        leaf* lf = l.load();
+        if(lf == nullptr)
+        {
+            leaf* fresh = new leaf{};
+            if(l.compare_exchange_strong(lf, fresh))
+            {
+                lf = fresh;
+            }
+            else
+            {
+                delete fresh;
+            }
+        }
+        return *lf;
+    }
+
+    uint32_t pop_free(chunk& c, uint32_t k)
+    {
+        uint64_t w = c.free.load();
+        while(head_of(w) != local_nil)
+        {
+            uint32_t next = c.nodes[head_of(w)].next.load(std::memory_order_relaxed);
+            uint32_t nextLocal = next == nil ? local_nil : next & chunk_mask;
+            if(c.free.compare_exchange_weak(w, pack(nextLocal, count_of(w) - 1, stamp_of(w) + 1)))
+            {
+                return k << chunk_bits | head_of(w);
+            }
+        }
+        return nil;
+    }
+
+    // returns how many nodes of c are free now
+    uint32_t push_free(chunk& c, uint32_t i)
+    {
+        const uint32_t base = i & ~chunk_mask;
+        uint64_t w = c.free.load();
+        do
+        {
+            c.nodes[i & chunk_mask].next.store(
+                    head_of(w) == local_nil ? nil : base | head_of(w), std::memory_order_relaxed);
+        }
+        while(!c.free.compare_exchange_weak(w, pack(i & chunk_mask, count_of(w) + 1, stamp_of(w) + 1)));
+        return count_of(w) + 1;
+    }
+
+    // install a chunk of free nodes in the lowest empty slot
+    bool grow()
+    {
+        chunk* c = new chunk{};
+        for(uint32_t k = 0; k < max_chunks; ++k)
+        {
+            auto& slot = leaf_for(k).slots[k & leaf_mask];
+            if(slot.load() != nullptr)
+            {
+                continue;
+            }
+
+            const uint32_t base = k << chunk_bits;
+            for(uint32_t j = 0; j < chunk_size; ++j)
+            {
+                c->nodes[j].next.store(j + 1 < chunk_size ? base + j + 1 : nil, std::memory_order_relaxed);
+            }
+            c->free.store(pack(0, chunk_size, 0), std::memory_order_relaxed);
+
+            chunk* expected = nullptr;
+            if(!slot.compare_exchange_strong(expected, c))
+            {
+                continue;
+            }
+            capacity_.fetch_add(chunk_size);
+            uint32_t high = highWater_.load();
+            while(high < k + 1 && !highWater_.compare_exchange_weak(high, k + 1));
+            return true;
+        }
+        delete c;
+        return false;
+    }
+
+    bool above_watermark() const
+    {
+        return 2 * live_.load() + chunk_size <= capacity_.load();
+    }
+
+    void sweep(hazard::guard& g)
+    {
+        for(uint32_t k = highWater_.load(); k > pinned_ && above_watermark(); --k)
+        {
+            chunk* c = protect_chunk(k - 1, g);
+            if(c != nullptr)
+            {
+                shrink(k - 1, c);
+            }
+        }
+    }
+
+    // c is chunk k, protected by the caller
+    void shrink(uint32_t k, chunk* c)
+    {
+        uint64_t w = c->free.load();
+        if(count_of(w) != chunk_size ||
+                !c->free.compare_exchange_strong(w, pack(local_nil, 0, stamp_of(w) + 1)))
+        {
+            return;
+        }
+        // closed: it looks fully allocated, and nothing in it is live
+        dir_[k >> leaf_bits].load()->slots[k & leaf_mask].store(nullptr);
+        capacity_.fetch_sub(chunk_size);
+        hazard::retire(c);
+    }
+
+    const uint32_t pinned_;
+    std::atomic<leaf*> dir_[1u << dir_bits]{};
+    std::atomic<uint32_t> highWater_{ 0 };
+    std::atomic<uint32_t> hint_{ 0 };
+    std::atomic<size_t> live_{ 0 };
+    std::atomic<size_t> capacity_{ 0 };
+};
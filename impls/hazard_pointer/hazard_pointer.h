@@ -0,0 +1,239 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/*
+    Hazard pointers (Michael 2004).
+
+    Every thread owns a record with a couple of hazard slots. Before touching a
+    shared node a thread publishes its address in a slot and re-reads the
+    source to check the node was not unlinked in between. A node that has been
+    unlinked is retired onto the thread's private list, and once that list is
+    long enough we scan every record: anything not named in a slot is freed.
+
+    Records are never freed while the program runs (they are recycled between
+    threads) so scanning them is always safe. Nodes still protected when a
+    thread exits are handed to the domain and picked up by the next scan.
+
+    Usage:
+
+        hazard::guard g{0};
+        Node* n = g.protect(head);   // n cannot be freed until g is cleared
+        ...
+        hazard::retire(n);           // after n has been unlinked
+*/
+namespace hazard
+{
+static constexpr size_t slots_per_thread = 3;
+
+struct retired_ptr
+{
+    void* ptr;
+    void (*deleter)(void*);
+};
+
+struct record
+{
+    std::atomic<void*> hp[slots_per_thread]{};
+    std::atomic<bool> active{ true };
+    record* next = nullptr;
+    std::vector<retired_ptr> retired;
+};
+
+struct domain
+{
+    static domain& global()
+    {
+        static domain d;
+        return d;
+    }
+
+    record* acquire()
+    {
+        for(record* r = head_.load(); r; r = r->next)
+        {
+            bool expected = false;
+            if(!r->active.load(std::memory_order_relaxed) &&
+                    r->active.compare_exchange_strong(expected, true))
+            {
+                return r;
+            }
+        }
+
+        record* r = new record{};
+        record* localHead = head_.load();
+        do
+        {
+            r->next = localHead;
+        } while(!head_.compare_exchange_weak(localHead, r));
+        count_.fetch_add(1, std::memory_order_relaxed);
+        return r;
+    }
+
+    void release(record* r)
+    {
+        for(auto& hp : r->hp)
+        {
+            hp.store(nullptr);
+        }
+        scan(*r);
+        if(!r->retired.empty())
+        {
+            std::unique_lock<std::mutex> lk{orphanLock_};
+            orphans_.insert(orphans_.end(), r->retired.begin(), r->retired.end());
+            r->retired.clear();
+        }
+        r->active.store(false);
+    }
+
+    void scan(record& mine)
+    {
+        {
+            std::unique_lock<std::mutex> lk{orphanLock_, std::try_to_lock};
+            if(lk && !orphans_.empty())
+            {
+                mine.retired.insert(mine.retired.end(), orphans_.begin(), orphans_.end());
+                orphans_.clear();
+            }
+        }
+
+        std::vector<void*> hazards;
+        for(record* r = head_.load(); r; r = r->next)
+        {
+            for(auto& hp : r->hp)
+            {
+                void* p = hp.load();
+                if(p)
+                {
+                    hazards.push_back(p);
+                }
+            }
+        }
+        std::sort(hazards.begin(), hazards.end());
+
+        auto still_hazardous = std::partition(mine.retired.begin(), mine.retired.end(),
+            [&hazards](const retired_ptr& rp){
+                return std::binary_search(hazards.begin(), hazards.end(), rp.ptr);
+            });
+
+        for(auto it = still_hazardous; it != mine.retired.end(); ++it)
+        {
+            it->deleter(it->ptr);
+        }
+        mine.retired.erase(still_hazardous, mine.retired.end());
+    }
+
+    size_t scan_threshold() const
+    {
+        return std::max<size_t>(64, 2 * slots_per_thread * count_.load(std::memory_order_relaxed));
+    }
+
+    ~domain()
+    {
+        // only reached at exit, once every other thread is gone
+        for(auto& rp : orphans_)
+        {
+            rp.deleter(rp.ptr);
+        }
+        record* r = head_.load();
+        while(r)
+        {
+            for(auto& rp : r->retired)
+            {
+                rp.deleter(rp.ptr);
+            }
+            record* next = r->next;
+            delete r;
+            r = next;
+        }
+    }
+
+private:
+    std::atomic<record*> head_{ nullptr };
+    std::atomic<size_t> count_{ 0 };
+    std::mutex orphanLock_;
+    std::vector<retired_ptr> orphans_;
+};
+
+namespace detail
+{
+struct record_holder
+{
+    record_holder()
+        : r(domain::global().acquire())
+    {}
+    ~record_holder()
+    {
+        domain::global().release(r);
+    }
+    record* r;
+};
+} // namespace detail
+
+inline record& this_thread_record()
+{
+    thread_local detail::record_holder holder;
+    return *holder.r;
+}
+
+/*
+    Owns one hazard slot of the calling thread for its lifetime.
+*/
+struct guard
+{
+    explicit guard(size_t slot)
+        : hp_(this_thread_record().hp[slot])
+    {}
+    guard(const guard&) = delete;
+    guard& operator=(const guard&) = delete;
+
+    template<typename T>
+    T* protect(const std::atomic<T*>& src)
+    {
+        T* p = src.load();
+        while(true)
+        {
+            hp_.store(p);
+            T* again = src.load();
+            if(again == p)
+            {
+                return p;
+            }
+            p = again;
+        }
+    }
+
+    // for pointers whose validity the caller re-checks itself
+    void set(void* p)
+    {
+        hp_.store(p);
+    }
+
+    void clear()
+    {
+        hp_.store(nullptr, std::memory_order_release);
+    }
+
+    ~guard()
+    {
+        clear();
+    }
+
+private:
+    std::atomic<void*>& hp_;
+};
+
+template<typename T>
+void retire(T* p)
+{
+    record& mine = this_thread_record();
+    mine.retired.push_back({p, [](void* q){ delete static_cast<T*>(q); }});
+
+    if(mine.retired.size() >= domain::global().scan_threshold())
+    {
+        domain::global().scan(mine);
+    }
+}
+} // namespace hazard
@@ -1,80 +1,181 @@
 #pragma once
+#include <algorithm>
 #include <atomic>
 #include <optional>
 #include <chrono>
 #include <random>
-#include "../StampedAllocator/StampedAllocator.h"
+#include <thread>
 
 using namespace std::chrono;
 
+enum class exchange_status
+{
+    matched,
+    timed_out,  // nobody showed up
+    collided,   // somebody of our own kind got to the slot first
+};
+
+/*
+    Exchanger that hands a value from one thread to another without copying it
+    anywhere in between.
+
+    A deliverer publishes a pointer to an offer on its own stack (a pointer to
+    its value and a taken flag) and waits. A receiver claims the offer by
+    swinging the slot from it back to null, moves the value out and only then
+    sets taken, after which the deliverer may return and its frame go away. A
+    deliverer that runs out of patience withdraws with the same CAS; if that
+    fails somebody has claimed the offer and it waits for taken.
 
+    Nothing is read through the pointer before the claiming CAS, so a stale
+    receiver that finds the same stack address published again simply takes
+    the new offer, which is live.
+
+    Waits are bounded by spins (loads of the slot) rather than by reading the
+    clock: see budget() for turning a wait into spins.
+*/
 template<typename T>
 struct Exchanger
 {
-    template<typename U>
-    using StampedRef = StampedRefNormal<U>; 
-
     Exchanger()
     {}
     std::optional<T> receive(system_clock::time_point try_until)
     {
-        while(system_clock::now() < try_until)
+        int spins = budget(try_until - system_clock::now());
+        std::optional<T> res;
+        while(spins-- > 0)
         {
-            auto local = curr_value.load(std::memory_order_acquire);
-
-            if(local.getStamp() != FULL)
+            if(receive_until(res, [&spins](){ return spins-- <= 0; }) == exchange_status::matched)
             {
-                continue;
-            }
-
-            if(curr_value.compare_exchange_strong(local, emptyNode, std::memory_order_seq_cst))
-            {
-                T res = *local.get_ptr();
-                delete local.get_ptr();
                 return res;
             }
         }
-
         return std::nullopt;
     }
     bool deliver(T& value, system_clock::time_point try_until)
     {
-        T* to_deliver = new T{value};
-        StampedRef<T> proposed{to_deliver, FULL};
+        int spins = budget(try_until - system_clock::now());
+        while(spins-- > 0)
+        {
+            if(deliver_until(value, [&spins](){ return spins-- <= 0; }) == exchange_status::matched)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // gives up at the first collision
+    exchange_status receive(std::optional<T>& res, int spins)
+    {
+        return receive_until(res, [&spins](){ return spins-- <= 0; });
+    }
+    exchange_status deliver(T& value, int spins)
+    {
+        return deliver_until(value, [&spins](){ return spins-- <= 0; });
+    }
+
+    // how many spins take about as long as wait
+    static int budget(nanoseconds wait)
+    {
+        return static_cast<int>(std::max<double>(0, wait.count() * spins_per_ns));
+    }
 
-        while(system_clock::now() < try_until)
+private:
+    struct offer
+    {
+        T* value;
+        std::atomic<bool> taken{ false };
+    };
+
+    template<typename Expired>
+    exchange_status receive_until(std::optional<T>& res, Expired expired)
+    {
+        while(!expired())
         {
-            auto local = curr_value.load(std::memory_order_acquire);
+            offer* o = slot.load(std::memory_order_acquire);
 
-            if(local.getStamp() != EMPTY)
+            if(o == nullptr)
             {
+                relax();
                 continue;
             }
 
-            if(curr_value.compare_exchange_strong(local, proposed, std::memory_order_seq_cst))
+            if(!slot.compare_exchange_strong(o, nullptr, std::memory_order_acq_rel))
             {
-                while(system_clock::now() < try_until)
-                {
-                    if(curr_value.load().getStamp() == EMPTY)
-                    {
-                        return true;
-                    }
-                }
-                // we've failed to perform an exchange
-                // do a CAS to set the current node to an emptyNode
-                // but if this happens to succeed then we return as such
-                if(!curr_value.compare_exchange_strong(proposed, emptyNode, std::memory_order_seq_cst))
-                {
-                    return true;
-                }
+                // another receiver took it, or its deliverer gave up
+                return exchange_status::collided;
             }
+            res.emplace(std::move(*o->value));
+            o->taken.store(true, std::memory_order_release);
+            return exchange_status::matched;
         }
-        return false;
+        return exchange_status::timed_out;
     }
-private:
-    static constexpr long EMPTY = 0, FULL = 1;
-    const StampedRef<T> emptyNode = {nullptr, EMPTY};
-    std::atomic<StampedRef<T>> curr_value = emptyNode;
+
+    template<typename Expired>
+    exchange_status deliver_until(T& value, Expired expired)
+    {
+        offer* local = slot.load(std::memory_order_relaxed);
+        if(local != nullptr)
+        {
+            // another deliverer is already waiting here
+            return exchange_status::collided;
+        }
+
+        offer mine{&value};
+        if(!slot.compare_exchange_strong(local, &mine, std::memory_order_release, std::memory_order_relaxed))
+        {
+            return exchange_status::collided;
+        }
+
+        while(!expired())
+        {
+            if(mine.taken.load(std::memory_order_acquire))
+            {
+                return exchange_status::matched;
+            }
+            relax();
+        }
+        offer* expected = &mine;
+        if(slot.compare_exchange_strong(expected, nullptr, std::memory_order_relaxed))
+        {
+            return exchange_status::timed_out;
+        }
+        // claimed just now: the receiver is still reading our frame
+        while(!mine.taken.load(std::memory_order_acquire))
+        {
+            std::this_thread::yield();
+        }
+        return exchange_status::matched;
+    }
+
+    // single core: spinning only delays the partner we are waiting for
+    static void relax()
+    {
+        if(single_core)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    // time a run of the load and relax the wait loops are made of
+    static double calibrate()
+    {
+        const int probes = single_core ? 1 << 8 : 1 << 14;
+        std::atomic<offer*> probe = nullptr;
+        auto start = steady_clock::now();
+        for(int i = 0; i < probes; ++i)
+        {
+            probe.load(std::memory_order_acquire);
+            relax();
+        }
+        auto took = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+        return static_cast<double>(probes) / std::max<long long>(took, 1);
+    }
+
+    static inline const bool single_core = std::thread::hardware_concurrency() <= 1;
+    static inline const double spins_per_ns = calibrate();
+    std::atomic<offer*> slot = nullptr;
 };
 
 template<typename T, size_t N = 8>
@@ -99,10 +200,122 @@ struct ExchangerArray
     {
         return arr[distribution(rng)].deliver(value, try_until);
     }
-    
+
 
 private:
     std::mt19937 rng;
     std::uniform_int_distribution<size_t> distribution;
     Exchanger<T> arr[N];
 };
+
+/*
+    Elimination arena that sizes itself to the contention (in the spirit of
+    Hendler, Shavit and Yerushalmi 2004).
+
+    Only the first range() of the N exchangers are in use. Every thread keeps
+    a preferred slot and goes back to it while it works: with few threads
+    around they all meet in slot 0, with many they spread out. The outcome of
+    each visit steers the range:
+
+    collided: somebody of our own kind held the slot - too many of us for too
+        few slots. Counts towards growing, and we move to another slot.
+    timed_out: nobody came - too few of us for this many slots. Counts towards
+        shrinking.
+
+    A thread only touches the shared range after grow_after / shrink_after
+    votes of its own, so one unlucky visit does not move it.
+
+    A visit waits at most wait nanoseconds, turned into a spin count once (see
+    Exchanger::budget) so the wait loop never reads the clock.
+*/
+template<typename T, size_t N = 32>
+struct EliminationArena
+{
+    static_assert(N > 0);
+
+    explicit EliminationArena(nanoseconds wait = nanoseconds{2000})
+        : spins(Exchanger<T>::budget(wait))
+    {}
+
+    bool deliver(T& value)
+    {
+        const size_t r = range_.load(std::memory_order_relaxed);
+        auto status = arr[me().slot % r].ex.deliver(value, spins);
+        adapt(status, r);
+        return status == exchange_status::matched;
+    }
+
+    std::optional<T> receive()
+    {
+        const size_t r = range_.load(std::memory_order_relaxed);
+        std::optional<T> res;
+        adapt(arr[me().slot % r].ex.receive(res, spins), r);
+        return res;
+    }
+
+    size_t range() const
+    {
+        return range_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr int grow_after = 4;
+    static constexpr int shrink_after = 8;
+    static constexpr size_t cacheLineSize = 64;
+
+    struct thread_state
+    {
+        size_t slot = 0;
+        int votes = 0;  // > 0: grow, < 0: shrink
+        uint32_t seed = static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id())) | 1;
+
+        size_t next_random()
+        {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            return seed;
+        }
+    };
+
+    static thread_state& me()
+    {
+        static thread_local thread_state state;
+        return state;
+    }
+
+    void adapt(exchange_status status, size_t r)
+    {
+        thread_state& s = me();
+        switch(status)
+        {
+        case exchange_status::matched:
+            s.votes = 0;
+            break;
+        case exchange_status::collided:
+            s.slot = s.next_random() % N;
+            if(++s.votes >= grow_after)
+            {
+                s.votes = 0;
+                range_.compare_exchange_strong(r, std::min(N, 2 * r), std::memory_order_relaxed);
+            }
+            break;
+        case exchange_status::timed_out:
+            if(--s.votes <= -shrink_after)
+            {
+                s.votes = 0;
+                range_.compare_exchange_strong(r, std::max<size_t>(1, r / 2), std::memory_order_relaxed);
+            }
+            break;
+        }
+    }
+
+    struct alignas(cacheLineSize) padded_exchanger
+    {
+        Exchanger<T> ex;
+    };
+
+    const int spins;
+    alignas(cacheLineSize) std::atomic<size_t> range_{ 1 };
+    padded_exchanger arr[N];
+};
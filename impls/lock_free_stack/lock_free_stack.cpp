@@ -1,127 +1,267 @@
-#include "lock_free_exchanger.h"
-#include "../StampedAllocator/StampedAllocator.h"
+#include "lock_free_stack.h"
+#include "../StampedAllocator/lock_free_allocator.h"
 #include "../../exercises/chapter10/test_pool.h"
-#include <optional>
-#include "thread_safe_alloc.h"
-#include <atomic>
-
-
-template<typename U>
-using MyStampedRef = StampedRefNormal<U>;
+#include <algorithm>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <vector>
 
+// the elimination layer we started with: 20 exchangers, a random one per visit, a flat 25ms wait
 template<typename T>
-struct StackNode
-{
-    StackNode(T val, MyStampedRef<StackNode<T>> _prev = nullptr)
-        : value(val), prev(_prev)
-    {}
-    T value;
-    MyStampedRef<StackNode<T>> prev;    
-};
-
-template<typename T, typename Allocator = ThreadSafeAllocator<StackNode<T>>>
-struct lock_free_stack
+struct fixed_arena
 {
-    lock_free_stack()
-        : head{nullptr}, alloc{}, arr{}
+    bool deliver(T& value)
     {
+        return arr.deliver(value, system_clock::now() + delay);
     }
-    template<typename ... Args>
-    bool enq(Args&&... args)
+    std::optional<T> receive()
     {
-        MyStampedRef<StackNode<T>> proposedNode = alloc.allocate();
-        
-        new (proposedNode.get_ptr()) StackNode<T>{T{std::forward<Args>(args)...}};
-        while(true)
+        return arr.receive(system_clock::now() + delay);
+    }
+private:
+    static constexpr auto delay = milliseconds{25};
+    ExchangerArray<T, 20> arr;
+};
+
+/*
+    One thread hands over move-only values through a single exchanger, the
+    other takes them: each arrives exactly once, in order, and a deliverer
+    that gives up keeps its value.
+*/
+void exchanger_test()
+{
+    static constexpr int items = 5000;
+    const int spins = Exchanger<std::unique_ptr<int>>::budget(microseconds{50});
+    Exchanger<std::unique_ptr<int>> ex;
+
+    std::thread deliverer([&ex, spins](){
+        for(int i = 0; i < items; ++i)
         {
-            if(try_enq(proposedNode))
-            {
-                return true;
-            }
-            /* size_t myIndex = exchangeGive.fetch_add(1); */
-            if(arr.deliver(proposedNode, std::chrono::system_clock::now() + delay))
+            auto v = std::make_unique<int>(i);
+            while(ex.deliver(v, spins) != exchange_status::matched)
             {
-                return true;
+                assert(v && *v == i);
+                std::this_thread::yield();
             }
+            assert(v == nullptr);
+        }
+    });
+    for(int i = 0; i < items; ++i)
+    {
+        std::optional<std::unique_ptr<int>> got;
+        while(ex.receive(got, spins) != exchange_status::matched)
+        {
             std::this_thread::yield();
-            /* else */
-            /* { */
-            /*     exchangeGive.fetch_sub(1); */
-            /* } */
         }
+        assert(**got == i);
     }
-    std::optional<T> deq(void)
+    deliverer.join();
+}
+
+void batch_test()
+{
+    lock_free_stack<int> S;
+    assert(S.pop_all().empty());
+
+    std::vector<int> batch{1, 2, 3, 4, 5};
+    S.push_chain(batch.begin(), batch.begin());
+    assert(S.empty());
+
+    S.enq(0);
+    S.push_chain(batch.begin(), batch.end());
+    S.enq(6);
+    assert(*S.deq() == 6);
+
+    std::vector<int> drained;
     {
-        while(true)
-        {
-            if(head.load(std::memory_order_acquire) == nullptr)
-            {
-                return std::nullopt;
-            }
+        auto all = S.pop_all();
+        drained.assign(all.begin(), all.end());
+        assert(S.empty());
+
+        // a popped chain goes back on as it is
+        S.enq(7);
+        S.push_chain(std::move(all));
+        assert(all.empty());
+    }
+    assert((drained == std::vector<int>{5, 4, 3, 2, 1, 0}));
+    for(int x : {5, 4, 3, 2, 1, 0, 7})
+    {
+        assert(*S.deq() == x);
+    }
+    assert(!S.deq().has_value());
+}
 
-            auto maybeRes = try_deq();
+/*
+    Producers push chains while consumers mix deq and pop_all: every item comes
+    out exactly once.
+*/
+void concurrent_batch_test()
+{
+    static constexpr int batches = 2000;
+    static constexpr int batch_size = 8;
+    static constexpr int per_producer = batches * batch_size;
 
-            if(maybeRes.has_value())
+    lock_free_stack<int> S;
+    producer_consumer_test(4, 4, per_producer,
+        [&S](int p){
+            std::vector<int> batch(batch_size);
+            for(int b = 0; b < batches; ++b)
             {
-                T res = (*maybeRes)->value;
-                alloc.deallocate((*maybeRes));
-                return res;
+                for(int i = 0; i < batch_size; ++i)
+                {
+                    batch[i] = p * per_producer + b * batch_size + i;
+                }
+                S.push_chain(batch.begin(), batch.end());
             }
-
-            // the issue is with the exchanging. Something is not working
-            /* size_t myIndex = exchangeTake.fetch_add(1); */
-            maybeRes = arr.receive(std::chrono::system_clock::now() + delay);
-            if(maybeRes.has_value())
+        },
+        [&S](int c, std::vector<int>& out){
+            if(c % 2 == 0)
+            {
+                auto all = S.pop_all();
+                out.insert(out.end(), all.begin(), all.end());
+            }
+            else if(auto x = S.deq())
             {
-                T res = (*maybeRes)->value;
-                alloc.deallocate((*maybeRes));
-                return res;
+                out.push_back(*x);
             }
+        });
+}
 
+/*
+    Producers enq while one thread keeps taking the whole stack with pop_all
+    and pushing it straight back, and consumers deq. A chain pushed back puts
+    the old top on head again, so a deq that read head before the pop_all
+    must not get to swing head past the nodes pushed in the meantime: every
+    item still comes out exactly once.
+*/
+void chain_recycle_test()
+{
+    static constexpr int per_producer = 20000;
+
+    lock_free_stack<int> S;
+    std::atomic<bool> done = false;
+
+    std::thread recycler([&](){
+        while(!done.load())
+        {
+            S.push_chain(S.pop_all());
             std::this_thread::yield();
-            /* else */
-            /* { */
-            /*     exchangeTake.fetch_sub(1); */
-            /* } */
         }
+    });
+    producer_consumer_test(2, 2, per_producer,
+        [&S](int p){
+            for(int i = 0; i < per_producer; ++i)
+            {
+                S.enq(p * per_producer + i);
+            }
+        },
+        [&S](int, std::vector<int>& out){
+            if(auto x = S.deq())
+            {
+                out.push_back(*x);
+            }
+        });
+    done = true;
+    recycler.join();
+    assert(S.empty());
+}
+
+#if defined(__x86_64__) && !defined(__SANITIZE_THREAD__)
+static_assert(lock_free_stack<int>::head_mode == stamped_atomic_mode::cmpxchg16b,
+        "head would go through libatomic");
+#endif
+
+using adaptive_stack = lock_free_stack<int>;
+using fixed_stack = lock_free_stack<int, ThreadSafeAllocator<StackNode<int>>,
+      fixed_arena<MyStampedRef<StackNode<int>>>>;
+using lock_free_alloc_stack = lock_free_stack<int, LockFreeStampedAllocator<StackNode<int>>>;
+
+struct run_stats
+{
+    double mops;
+    long long p99_ns;
+};
+
+/*
+    Every thread alternates push and pop on a stack that starts with a few
+    items on it, timing each operation.
+*/
+template<typename Stack>
+run_stats push_pop(size_t threads)
+{
+    static constexpr size_t total = 1 << 17;
+    const size_t per_thread = total / threads;
+
+    auto S = std::make_unique<Stack>();
+    for(int i = 0; i < 64; ++i)
+    {
+        S->enq(i);
     }
-    bool empty() const
+    std::vector<std::vector<long long>> latencies(threads);
+    std::vector<std::thread> workers;
+
+    auto start_time = steady_clock::now();
+    for(size_t t = 0; t < threads; ++t)
     {
-        return head.load() == nullptr;
+        workers.emplace_back([&S, &lat = latencies[t], per_thread](){
+            lat.reserve(per_thread);
+            for(size_t i = 0; i < per_thread; ++i)
+            {
+                auto before = steady_clock::now();
+                if(i % 2 == 0)
+                {
+                    S->enq(static_cast<int>(i));
+                }
+                else
+                {
+                    S->deq();
+                }
+                lat.push_back(duration_cast<nanoseconds>(steady_clock::now() - before).count());
+            }
+        });
     }
-private:
-    std::optional<MyStampedRef<StackNode<T>>> try_deq(void)
+    for(auto& th : workers)
     {
-        auto localHead = head.load(std::memory_order_acquire);
-        if(localHead == nullptr)
-        {
-            return std::nullopt;
-        }
-        auto prevHead = localHead->prev;
-
-        if(head.compare_exchange_strong(localHead, prevHead))
-        {
-            return std::make_optional<MyStampedRef<StackNode<T>>>(std::move(localHead));
-        }
-        return std::nullopt;
+        th.join();
     }
-    bool try_enq(MyStampedRef<StackNode<T>> node)
+    auto total_time = duration_cast<nanoseconds>(steady_clock::now() - start_time);
+
+    std::vector<long long> all;
+    for(auto& lat : latencies)
     {
-        auto localHead = head.load(std::memory_order_acquire);
-        node->prev = localHead;
-        return head.compare_exchange_strong(localHead, node);
+        all.insert(all.end(), lat.begin(), lat.end());
     }
-    std::atomic<size_t> exchangeGive = 0;
-    std::atomic<size_t> exchangeTake = 0;
-    std::atomic<MyStampedRef<StackNode<T>>> head = nullptr;
-    Allocator alloc;
-    static constexpr auto delay = std::chrono::milliseconds{25};
-    ExchangerArray<MyStampedRef<StackNode<T>>, 20> arr;
-};
+    auto p99 = all.begin() + all.size() * 99 / 100;
+    std::nth_element(all.begin(), p99, all.end());
 
+    return { static_cast<double>(all.size()) * 1e3 / total_time.count(), *p99 };
+}
+
+void benchmark()
+{
+    for(size_t threads = 1; threads <= 64; threads *= 2)
+    {
+        auto adaptive = push_pop<adaptive_stack>(threads);
+        auto fixed = push_pop<fixed_stack>(threads);
+        auto lock_free_alloc = push_pop<lock_free_alloc_stack>(threads);
+        std::cout << std::format("{} threads: adaptive arena {:.2f} Mops/s, p99 {}ns; fixed arena {:.2f} Mops/s, p99 {}ns; "
+                "lock-free allocator {:.2f} Mops/s, p99 {}ns\n",
+                threads, adaptive.mops, adaptive.p99_ns, fixed.mops, fixed.p99_ns,
+                lock_free_alloc.mops, lock_free_alloc.p99_ns);
+    }
+}
 
 int main()
 {
     lock_free_stack<int> S;
     test_pool(S);
+    lock_free_alloc_stack L;
+    test_pool(L);
+    exchanger_test();
+    batch_test();
+    concurrent_batch_test();
+    chain_recycle_test();
+
+    benchmark();
 }
@@ -0,0 +1,284 @@
+#pragma once
+#include "lock_free_exchanger.h"
+#include "../StampedAllocator/StampedAllocator.h"
+#include "../StampedAllocator/atomic_stamped_ref.h"
+#include <optional>
+#include "thread_safe_alloc.h"
+#include "../backoff/backoff.h"
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <thread>
+#include <utility>
+
+
+template<typename U>
+using MyStampedRef = StampedRefNormal<U>;
+
+template<typename T>
+struct StackNode
+{
+    StackNode(T val, MyStampedRef<StackNode<T>> _prev = nullptr)
+        : value(val), prev(_prev)
+    {}
+    T value;
+    MyStampedRef<StackNode<T>> prev;    
+};
+
+/*
+    Treiber stack with an elimination layer: a push and a pop that both lose
+    the CAS on head can cancel out in the Arena instead (an EliminationArena
+    by default, which see) and leave head alone. When both fail we back off
+    (Backoff, see backoff.h) before trying again.
+
+    push_chain links its nodes into a private chain first and attaches the
+    whole chain with one CAS on head. pop_all swaps head to null and hands the
+    old stack back as a chain that frees its nodes when it goes away; a chain
+    can also be pushed back as it is, with a fresh stamp on its top.
+*/
+template<
+    typename T,
+    typename Allocator = ThreadSafeAllocator<StackNode<T>>,
+    typename Arena = EliminationArena<MyStampedRef<StackNode<T>>>,
+    typename Backoff = backoff::tiered<>
+    >
+struct lock_free_stack
+{
+    // how head is made atomic: see atomic_stamped_ref.h
+    static constexpr stamped_atomic_mode head_mode = atomic_stamped_ref<MyStampedRef<StackNode<T>>>::mode;
+
+    lock_free_stack()
+        : head{nullptr}, alloc{}, arr{}
+    {
+    }
+    /*
+        Owns a detached run of nodes. Iterating yields the values top first (the
+        order deq would have returned them). Must not outlive the stack (its
+        nodes go back through the stack's allocator).
+    */
+    struct chain
+    {
+        struct iterator
+        {
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = T;
+            using difference_type = std::ptrdiff_t;
+            using pointer = T*;
+            using reference = T&;
+
+            T& operator*() const { return node->value; }
+            T* operator->() const { return &node->value; }
+            iterator& operator++()
+            {
+                node = node->prev.get_ptr();
+                return *this;
+            }
+            iterator operator++(int)
+            {
+                iterator res = *this;
+                ++*this;
+                return res;
+            }
+            bool operator==(const iterator&) const = default;
+
+            StackNode<T>* node;
+        };
+
+        chain(lock_free_stack* owner = nullptr, MyStampedRef<StackNode<T>> first = nullptr)
+            : owner_(owner), first_(first)
+        {}
+        chain(chain&& other) noexcept
+            : owner_(other.owner_),
+            first_(std::exchange(other.first_, nullptr))
+        {}
+        chain(const chain&) = delete;
+
+        iterator begin() { return {first_.get_ptr()}; }
+        iterator end() { return {nullptr}; }
+        bool empty() { return first_ == nullptr; }
+
+        ~chain()
+        {
+            while(!(first_ == nullptr))
+            {
+                auto next = first_->prev;
+                first_->~StackNode<T>();
+                owner_->alloc.deallocate(first_);
+                first_ = next;
+            }
+        }
+
+    private:
+        friend lock_free_stack;
+
+        lock_free_stack* owner_;
+        MyStampedRef<StackNode<T>> first_;
+    };
+
+    // afterwards *(last - 1) is on top, as if each value had been pushed in turn
+    template<typename It>
+    void push_chain(It first, It last)
+    {
+        if(first == last)
+        {
+            return;
+        }
+
+        MyStampedRef<StackNode<T>> bottom = make_node(*first);
+        MyStampedRef<StackNode<T>> top = bottom;
+        for(++first; first != last; ++first)
+        {
+            auto node = make_node(*first);
+            node->prev = top;
+            top = node;
+        }
+        attach(top, bottom);
+    }
+
+    // c's top value ends up on top
+    void push_chain(chain&& c)
+    {
+        if(c.empty())
+        {
+            return;
+        }
+        MyStampedRef<StackNode<T>> top = std::exchange(c.first_, nullptr);
+        // top goes back on head: under its old stamp, a try_deq that read
+        // head before pop_all could still swing head past whatever is now below
+        top.incStamp();
+        MyStampedRef<StackNode<T>> bottom = top;
+        while(!(bottom->prev == nullptr))
+        {
+            bottom = bottom->prev;
+        }
+        attach(top, bottom);
+    }
+
+    chain pop_all()
+    {
+        return {this, head.exchange(nullptr, std::memory_order_acq_rel)};
+    }
+
+    template<typename ... Args>
+    bool enq(Args&&... args)
+    {
+        MyStampedRef<StackNode<T>> proposedNode = alloc.allocate();
+        
+        new (proposedNode.get_ptr()) StackNode<T>{T{std::forward<Args>(args)...}};
+        Backoff backoff;
+        while(true)
+        {
+            if(try_enq(proposedNode))
+            {
+                return true;
+            }
+            /* size_t myIndex = exchangeGive.fetch_add(1); */
+            if(arr.deliver(proposedNode))
+            {
+                return true;
+            }
+            backoff();
+            /* else */
+            /* { */
+            /*     exchangeGive.fetch_sub(1); */
+            /* } */
+        }
+    }
+    std::optional<T> deq(void)
+    {
+        Backoff backoff;
+        while(true)
+        {
+            if(head.load(std::memory_order_acquire) == nullptr)
+            {
+                return std::nullopt;
+            }
+
+            auto maybeRes = try_deq();
+
+            if(maybeRes.has_value())
+            {
+                T res = (*maybeRes)->value;
+                alloc.deallocate((*maybeRes));
+                return res;
+            }
+
+            // the issue is with the exchanging. Something is not working
+            /* size_t myIndex = exchangeTake.fetch_add(1); */
+            maybeRes = arr.receive();
+            if(maybeRes.has_value())
+            {
+                T res = (*maybeRes)->value;
+                alloc.deallocate((*maybeRes));
+                return res;
+            }
+
+            backoff();
+            /* else */
+            /* { */
+            /*     exchangeTake.fetch_sub(1); */
+            /* } */
+        }
+    }
+    bool empty() const
+    {
+        return head.load() == nullptr;
+    }
+    ~lock_free_stack()
+    {
+        while(auto node = try_deq())
+        {
+            alloc.deallocate(*node);
+        }
+    }
+private:
+    template<typename U>
+    MyStampedRef<StackNode<T>> make_node(U&& value)
+    {
+        MyStampedRef<StackNode<T>> node = alloc.allocate();
+        new (node.get_ptr()) StackNode<T>{T{std::forward<U>(value)}};
+        return node;
+    }
+
+    // top ... bottom are linked through prev; one CAS puts them all on
+    void attach(MyStampedRef<StackNode<T>> top, MyStampedRef<StackNode<T>> bottom)
+    {
+        auto localHead = head.load(std::memory_order_acquire);
+        for(Backoff backoff; ; backoff())
+        {
+            bottom->prev = localHead;
+            if(head.compare_exchange_strong(localHead, top))
+            {
+                return;
+            }
+        }
+    }
+
+    std::optional<MyStampedRef<StackNode<T>>> try_deq(void)
+    {
+        auto localHead = head.load(std::memory_order_acquire);
+        if(localHead == nullptr)
+        {
+            return std::nullopt;
+        }
+        auto prevHead = localHead->prev;
+
+        if(head.compare_exchange_strong(localHead, prevHead))
+        {
+            return std::make_optional<MyStampedRef<StackNode<T>>>(std::move(localHead));
+        }
+        return std::nullopt;
+    }
+    bool try_enq(MyStampedRef<StackNode<T>> node)
+    {
+        auto localHead = head.load(std::memory_order_acquire);
+        node->prev = localHead;
+        return head.compare_exchange_strong(localHead, node);
+    }
+    std::atomic<size_t> exchangeGive = 0;
+    std::atomic<size_t> exchangeTake = 0;
+    atomic_stamped_ref<MyStampedRef<StackNode<T>>> head{ nullptr };
+    Allocator alloc;
+    Arena arr;
+};
+
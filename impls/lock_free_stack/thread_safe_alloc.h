@@ -3,12 +3,15 @@
 #include <vector>
 #include <iostream>
 #include <cassert>
+#include <type_traits>
+#include <unordered_map>
 #include "../StampedAllocator/StampedAllocator.h"
+#include "../StampedAllocator/alloc_stats.h"
 
 template<typename T>
 using StampedRef = StampedRefNormal<T>;
 
-template<typename T>
+template<typename T, typename Stats = alloc_stats::none>
 class ThreadSafeAllocator {
 public:
     using value_type = T;
@@ -19,11 +22,12 @@ public:
         std::lock_guard<std::mutex> lock{mtx};
         if (free_list.empty()) {
             T* ptr = static_cast<T*>(::operator new(sizeof(T)));
-            return StampedRef<T>{ptr};
+            _stats.base_call();
+            return handed_out(StampedRef<T>{ptr});
         } else {
             StampedRef<T> ptr = free_list.back();
             free_list.pop_back();
-            return ptr;
+            return handed_out(ptr);
         }
     }
 
@@ -31,13 +35,27 @@ public:
         std::lock_guard<std::mutex> lock{mtx};
         /* auto it = std::find(free_list.begin(), free_list.end(), p); */
         /* assert(it == free_list.end() && "double free"); */
+        if constexpr (Stats::enabled) {
+            auto it = owners.find(p.get_ptr());
+            if (it != owners.end() && it->second != alloc_stats::thread_serial()) {
+                _stats.cross_thread();
+            }
+            _stats.freed();
+        }
         p.incStamp();
+        if (p.getStamp() == 0) {
+            _stats.stamp_wrap();
+        }
         free_list.push_back(p);
     }
 
+    alloc_stats::totals stats() const {
+        return _stats.snapshot();
+    }
+
     ~ThreadSafeAllocator()
     {
-        std::cout << "dealloc begin\n";
+        _stats.dump("ThreadSafeAllocator");
         while(!free_list.empty())
         {
             StampedRef<T> back = free_list.back();
@@ -47,6 +65,20 @@ public:
     }
 
 private:
+    // who took each block, for spotting cross-thread frees; only kept with stats on
+    struct no_owners {};
+    using owner_map = std::conditional_t<Stats::enabled, std::unordered_map<T*, uint64_t>, no_owners>;
+
+    StampedRef<T> handed_out(StampedRef<T> p) {
+        if constexpr (Stats::enabled) {
+            owners[p.get_ptr()] = alloc_stats::thread_serial();
+            _stats.allocated();
+        }
+        return p;
+    }
+
     std::vector<StampedRef<T>> free_list;
     std::mutex mtx;
+    [[no_unique_address]] owner_map owners;
+    [[no_unique_address]] Stats _stats;
 };
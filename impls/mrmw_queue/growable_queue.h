@@ -0,0 +1,403 @@
+#pragma once
+/*
+    MRMW queue whose capacity can change while it is in use.
+
+    The queue is a chain of rings, oldest first. Each ring is the same turn based
+    ring as MRMWQueue (power of two capacity so idx / turn are a mask and a
+    shift), with one addition: the top bit of head_ is a "closed" bit. Once a
+    ring is closed no producer can take a new ticket in it.
+
+    Resizing to a new capacity:
+
+        1. link a fresh ring after the newest ring (one CAS: only one resize
+           can be in flight per ring)
+        2. close the old ring
+        3. swing enqRing_ to the new ring (anyone who sees a closed ring helps)
+
+    Producers always write into enqRing_. Consumers read from deqRing_ and only
+    step to the next ring once the current one is closed and every ticket taken
+    in it has been consumed, so FIFO order is kept across a resize. The drained
+    ring is retired with hazard pointers since slow threads may still hold it.
+
+    Growing and shrinking are the same operation with a different capacity;
+    shrinking below the live size is fine, the old ring simply drains first.
+
+    resize_policy decides when this happens on its own:
+        - grow when an enq finds the ring at high_watermark (1.0 = only on full,
+          by count: a slot a slow deq has not released yet is waited for)
+        - shrink when a deq leaves the ring below low_watermark
+    Keep low_watermark well under high_watermark / 2 so the two do not flap.
+*/
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <optional>
+#include <thread>
+#include <vector>
+#include "../hazard_pointer/hazard_pointer.h"
+
+struct resize_policy
+{
+    double high_watermark = 1.0;
+    double low_watermark = 0.0;
+    size_t min_capacity = 16;
+    size_t max_capacity = size_t{1} << 30;
+};
+
+template<typename T>
+struct GrowableMRMWQueue
+{
+    explicit GrowableMRMWQueue(size_t capacity, resize_policy policy = resize_policy{})
+        : policy_(policy)
+    {
+        ring* first = new ring(std::bit_ceil(capacity), policy_);
+        enqRing_.store(first);
+        deqRing_.store(first);
+    }
+
+    template<typename ... Args>
+    bool enq(Args&&... args)
+    {
+        hazard::guard g{0};
+
+        while(true)
+        {
+            ring* r = g.protect(enqRing_);
+
+            switch(r->try_enq(std::forward<Args>(args)...))
+            {
+                case enq_result::ok:
+                {
+                    return true;
+                }
+                case enq_result::above_watermark:
+                {
+                    if(r->capacity() < policy_.max_capacity)
+                    {
+                        resize_from(r, r->capacity() * 2);
+                    }
+                    return true;
+                }
+                case enq_result::closed:
+                {
+                    help_advance(r);
+                    break;
+                }
+                case enq_result::full:
+                {
+                    if(r->capacity() >= policy_.max_capacity)
+                    {
+                        return false;
+                    }
+                    resize_from(r, r->capacity() * 2);
+                    break;
+                }
+            }
+        }
+    }
+
+    template<typename ... Args>
+    void force_enq(Args&&... args)
+    {
+        while(!enq(std::forward<Args>(args)...));
+    }
+
+    std::optional<T> deq()
+    {
+        hazard::guard g{0};
+
+        while(true)
+        {
+            ring* r = g.protect(deqRing_);
+            bool below_watermark = false;
+
+            auto res = r->try_deq(below_watermark);
+            if(res)
+            {
+                if(below_watermark && r->capacity() > policy_.min_capacity)
+                {
+                    resize_from(r, r->capacity() / 2);
+                }
+                return res;
+            }
+
+            ring* next = r->next.load();
+            if(next == nullptr || !r->drained())
+            {
+                return std::nullopt;
+            }
+
+            // r may only be retired once nothing shared points at it
+            help_advance(r);
+            if(deqRing_.compare_exchange_strong(r, next))
+            {
+                g.clear();
+                hazard::retire(r);
+            }
+        }
+    }
+
+    T force_deq()
+    {
+        while(true)
+        {
+            auto res = deq();
+            if(res)
+            {
+                return std::move(*res);
+            }
+        }
+    }
+
+    /*
+        Start a migration to a ring of (at least) new_capacity. Returns false if
+        another resize of the current ring is already in flight.
+    */
+    bool resize(size_t new_capacity)
+    {
+        hazard::guard g{0};
+        ring* r = g.protect(enqRing_);
+        return resize_from(r, new_capacity);
+    }
+
+    bool grow()
+    {
+        return resize(capacity() * 2);
+    }
+
+    bool shrink()
+    {
+        return resize(capacity() / 2);
+    }
+
+    // capacity of the ring producers are currently writing to
+    size_t capacity()
+    {
+        hazard::guard g{0};
+        return g.protect(enqRing_)->capacity();
+    }
+
+    /*
+        While a migration is unfinished this reports non-empty: the next deq
+        either finds an item or finishes stepping consumers onto the new ring.
+    */
+    bool empty()
+    {
+        hazard::guard g{0};
+        ring* r = g.protect(deqRing_);
+        return r->next.load() == nullptr && r->empty();
+    }
+
+    ~GrowableMRMWQueue()
+    {
+        ring* r = deqRing_.load();
+        while(r)
+        {
+            ring* next = r->next.load();
+            delete r;
+            r = next;
+        }
+    }
+
+private:
+    enum class enq_result
+    {
+        ok, above_watermark, full, closed
+    };
+
+    struct slot
+    {
+        std::atomic<size_t> turn{ 0 };
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T* item() { return std::launder(reinterpret_cast<T*>(storage)); }
+    };
+
+    struct ring
+    {
+        static constexpr size_t CLOSED = size_t{1} << (sizeof(size_t) * 8 - 1);
+        static constexpr size_t cacheLineSize = 64;
+
+        ring(size_t capacity, const resize_policy& policy)
+            : mask_(capacity - 1),
+            shift_(std::countr_zero(capacity)),
+            highMark_(static_cast<size_t>(capacity * policy.high_watermark)),
+            lowMark_(static_cast<size_t>(capacity * policy.low_watermark)),
+            data_(capacity)
+        {
+            assert(std::has_single_bit(capacity));
+        }
+
+        template<typename ... Args>
+        enq_result try_enq(Args&&... args)
+        {
+            auto localHead = head_.load(std::memory_order_acquire);
+
+            while(true)
+            {
+                if(localHead & CLOSED)
+                {
+                    return enq_result::closed;
+                }
+
+                if(turn(localHead)*2 == data_[idx(localHead)].turn.load())
+                {
+                    if(head_.compare_exchange_strong(localHead, localHead + 1))
+                    {
+                        new (data_[idx(localHead)].item()) T{std::forward<Args>(args)...};
+                        data_[idx(localHead)].turn.store(turn(localHead)*2 + 1);
+
+                        if(highMark_ <= mask_ && filled(localHead + 1) >= highMark_)
+                        {
+                            return enq_result::above_watermark;
+                        }
+                        return enq_result::ok;
+                    }
+                }
+                else
+                {
+                    auto nextHead = head_.load(std::memory_order_acquire);
+                    if(localHead == nextHead)
+                    {
+                        if(filled(localHead) >= capacity())
+                        {
+                            return enq_result::full;
+                        }
+                        // not full by count: a deq has claimed the slot and
+                        // not yet released it, which is no reason to grow
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    localHead = nextHead;
+                }
+            }
+        }
+
+        std::optional<T> try_deq(bool& below_watermark)
+        {
+            auto localTail = tail_.load(std::memory_order_acquire);
+
+            while(true)
+            {
+                if(turn(localTail)*2 + 1 == data_[idx(localTail)].turn.load())
+                {
+                    if(tail_.compare_exchange_strong(localTail, localTail + 1))
+                    {
+                        T* item = data_[idx(localTail)].item();
+                        auto res = std::make_optional<T>(std::move(*item));
+                        item->~T();
+                        data_[idx(localTail)].turn.store(turn(localTail)*2 + 2);
+
+                        if(lowMark_ > 0)
+                        {
+                            auto localHead = head_.load(std::memory_order_relaxed);
+                            below_watermark = !(localHead & CLOSED) &&
+                                localHead - (localTail + 1) < lowMark_;
+                        }
+                        return res;
+                    }
+                }
+                else
+                {
+                    auto nextTail = tail_.load();
+                    if(nextTail == localTail)
+                    {
+                        return std::nullopt;
+                    }
+                    localTail = nextTail;
+                }
+            }
+        }
+
+        void close()
+        {
+            head_.fetch_or(CLOSED);
+        }
+
+        // closed and every ticket handed out has been consumed
+        bool drained() const
+        {
+            auto localHead = head_.load();
+            return (localHead & CLOSED) && tail_.load() == (localHead & ~CLOSED);
+        }
+
+        bool empty() const
+        {
+            return (head_.load() & ~CLOSED) == tail_.load();
+        }
+
+        size_t capacity() const
+        {
+            return mask_ + 1;
+        }
+
+        ~ring()
+        {
+            auto localTail = tail_.load();
+            auto localHead = head_.load() & ~CLOSED;
+            for(; localTail != localHead; ++localTail)
+            {
+                data_[idx(localTail)].item()->~T();
+            }
+        }
+
+        std::atomic<ring*> next{ nullptr };
+
+    private:
+        /*
+            Items before ticket head, as far as tail_ knows. Deqs may already
+            have taken tail_ past head: that is an empty ring, not a
+            wrapped-around full one.
+        */
+        size_t filled(size_t head) const
+        {
+            auto localTail = tail_.load(std::memory_order_relaxed);
+            return localTail > head ? 0 : head - localTail;
+        }
+
+        size_t idx(size_t i) const { return i & mask_; }
+        size_t turn(size_t i) const { return i >> shift_; }
+
+        const size_t mask_;
+        const size_t shift_;
+        const size_t highMark_;
+        const size_t lowMark_;
+        std::vector<slot> data_;
+        alignas(cacheLineSize) std::atomic<size_t> head_{ 0 };
+        alignas(cacheLineSize) std::atomic<size_t> tail_{ 0 };
+    };
+
+    // caller must hold a hazard pointer on r
+    bool resize_from(ring* r, size_t new_capacity)
+    {
+        new_capacity = std::clamp(std::bit_ceil(new_capacity),
+                policy_.min_capacity, policy_.max_capacity);
+        if(new_capacity == r->capacity())
+        {
+            return false;
+        }
+
+        ring* fresh = new ring(new_capacity, policy_);
+        ring* expected = nullptr;
+        if(!r->next.compare_exchange_strong(expected, fresh))
+        {
+            delete fresh;
+            return false;
+        }
+
+        r->close();
+        help_advance(r);
+        return true;
+    }
+
+    void help_advance(ring* r)
+    {
+        ring* next = r->next.load();
+        assert(next != nullptr && "closed ring must have a successor");
+        enqRing_.compare_exchange_strong(r, next);
+    }
+
+    const resize_policy policy_;
+    alignas(64) std::atomic<ring*> enqRing_;
+    alignas(64) std::atomic<ring*> deqRing_;
+};
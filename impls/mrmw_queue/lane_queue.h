@@ -0,0 +1,217 @@
+#pragma once
+/*
+    Priority queue made of one MRMWQueue per lane. Lane 0 is the highest priority.
+
+    nonEmpty_ has a bit per lane so an idle consumer finds work (or finds there
+    is none) with one load instead of polling every lane. A producer sets the
+    bit after publishing its item; a consumer that finds a lane empty clears the
+    bit and then looks at the lane again, setting the bit back if something
+    arrived in between. Both sides are "publish then check" on seq_cst
+    atomics, so a bit can never be cleared while its lane holds an item that
+    nobody will see.
+
+    Scheduling:
+        strict   - always the highest priority non-empty lane
+        weighted - lane i gets weights[i] of every sum(weights) deqs while it
+                   has work (smooth weighted round robin, so the turns of a lane
+                   are spread out rather than bunched). A lane that has no
+                   work on its turn falls back to strict order, so no deq is
+                   wasted.
+
+    The round robin position is a cursor per (queue, thread), a ThreadLocal
+    (see MultithreadAlloc/ThreadLocalDynamic.h), so consumers never contend on
+    scheduling state, and a thread serving several queues keeps each one's
+    ratio.
+*/
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+#include "mrmw_queue.h"
+#include "../MultithreadAlloc/ThreadLocalDynamic.h"
+
+template<typename T, size_t Lanes>
+struct LaneQueue
+{
+    static_assert(Lanes > 0 && Lanes <= 64, "one bit per lane in the bitmap");
+
+    // strict priority
+    explicit LaneQueue(size_t capacity_per_lane)
+        : LaneQueue(capacity_per_lane, std::make_index_sequence<Lanes>())
+    {}
+
+    // weighted round robin
+    LaneQueue(size_t capacity_per_lane, const std::array<size_t, Lanes>& weights)
+        : LaneQueue(capacity_per_lane)
+    {
+        build_schedule(weights);
+    }
+
+    template<typename ... Args>
+    bool enq(size_t lane, Args&&... args)
+    {
+        assert(lane < Lanes);
+        if(!lanes_[lane].enq(std::forward<Args>(args)...))
+        {
+            return false;
+        }
+
+        // skip the RMW while the bit is already up (the common case under load)
+        if(!(nonEmpty_.load() & bit(lane)))
+        {
+            nonEmpty_.fetch_or(bit(lane));
+        }
+        return true;
+    }
+
+    template<typename ... Args>
+    void force_enq(size_t lane, Args&&... args)
+    {
+        while(!enq(lane, std::forward<Args>(args)...));
+    }
+
+    std::optional<T> deq()
+    {
+        size_t lane;
+        return deq(lane);
+    }
+
+    // as deq, also reporting which lane the item came from
+    std::optional<T> deq(size_t& from_lane)
+    {
+        uint64_t bits = nonEmpty_.load();
+        if(bits == 0)
+        {
+            return std::nullopt;
+        }
+
+        if(!schedule_.empty())
+        {
+            size_t preferred = schedule_[next_turn() % schedule_.size()];
+            if(bits & bit(preferred))
+            {
+                auto res = try_lane(preferred);
+                if(res)
+                {
+                    from_lane = preferred;
+                    return res;
+                }
+                bits = nonEmpty_.load();
+            }
+        }
+
+        while(bits)
+        {
+            size_t lane = std::countr_zero(bits);
+            auto res = try_lane(lane);
+            if(res)
+            {
+                from_lane = lane;
+                return res;
+            }
+            bits &= ~bit(lane);
+        }
+        return std::nullopt;
+    }
+
+    // bits are only cleared lazily by deq, so check the lanes they point at
+    bool empty() const
+    {
+        for(uint64_t bits = nonEmpty_.load(); bits; bits &= bits - 1)
+        {
+            if(!lanes_[std::countr_zero(bits)].empty())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool empty(size_t lane) const
+    {
+        return lanes_[lane].empty();
+    }
+
+private:
+    template<size_t ... Is>
+    LaneQueue(size_t capacity_per_lane, std::index_sequence<Is...>)
+        : lanes_{ make_lane(Is, capacity_per_lane)... }
+    {}
+
+    static MRMWQueue<T> make_lane(size_t, size_t capacity)
+    {
+        return MRMWQueue<T>(capacity);
+    }
+
+    static constexpr uint64_t bit(size_t lane)
+    {
+        return uint64_t{1} << lane;
+    }
+
+    std::optional<T> try_lane(size_t lane)
+    {
+        auto res = lanes_[lane].deq();
+        if(res || !lanes_[lane].empty())
+        {
+            return res;
+        }
+
+        nonEmpty_.fetch_and(~bit(lane));
+        if(!lanes_[lane].empty())
+        {
+            nonEmpty_.fetch_or(bit(lane));
+        }
+        return std::nullopt;
+    }
+
+    /*
+        Smooth weighted round robin: every step each lane gains its weight,
+        the lane with the most credit is picked and pays back the total.
+    */
+    void build_schedule(const std::array<size_t, Lanes>& weights)
+    {
+        long total = 0;
+        for(auto w : weights)
+        {
+            total += static_cast<long>(w);
+        }
+        assert(total > 0 && "weighted mode needs a non-zero weight");
+
+        std::array<long, Lanes> credit{};
+        for(long step = 0; step < total; ++step)
+        {
+            size_t best = 0;
+            for(size_t lane = 0; lane < Lanes; ++lane)
+            {
+                credit[lane] += static_cast<long>(weights[lane]);
+                if(credit[lane] > credit[best])
+                {
+                    best = lane;
+                }
+            }
+            credit[best] -= total;
+            schedule_.push_back(best);
+        }
+    }
+
+    // this thread's position in schedule_, then moved on by one
+    size_t next_turn()
+    {
+        size_t* cursor = cursor_.find();
+        if(cursor == nullptr)
+        {
+            cursor_.store(0);
+            cursor = cursor_.find();
+        }
+        return (*cursor)++;
+    }
+
+    std::array<MRMWQueue<T>, Lanes> lanes_;
+    std::vector<size_t> schedule_;
+    alignas(64) std::atomic<uint64_t> nonEmpty_{ 0 };
+    ThreadLocal<LaneQueue, size_t> cursor_;
+};
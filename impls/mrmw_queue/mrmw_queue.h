@@ -13,6 +13,12 @@
     the same index) and so this offers priority between them.
 
     Heavy inspiration from Eric Rigtorps MCMP Queue
+
+    async_enq / async_deq are the coroutine versions of force_enq / force_deq:
+    rather than spinning on the slot they park the coroutine on a waiter list,
+    and every successful deq (enq) wakes the parked enqueuers (dequeuers).
+
+    Lost CASes and the force_ spins back off with Backoff (see backoff.h).
 */
 #include <atomic>
 #include <vector>
@@ -20,6 +26,8 @@
 #include <format>
 #include <new>
 #include "../../exercises/chapter10/test_pool.h"
+#include "../coroutine_queue/waiter_list.h"
+#include "../backoff/backoff.h"
 
 #if defined(if_debug)
     // already defined, no need to redefine
@@ -42,6 +50,12 @@ struct queue_traits<int>
     static int empty_value() { return -1; }
 };
 
+template<typename U>
+struct queue_traits<U*>
+{
+    static U* empty_value() { return nullptr; }
+};
+
 template<typename T>
 struct slot
 {
@@ -57,7 +71,7 @@ struct slot
     T item;
 };
 
-template<typename T>
+template<typename T, typename Backoff = backoff::tiered<>>
 struct MRMWQueue
 {
     MRMWQueue(size_t capacity)
@@ -69,17 +83,19 @@ struct MRMWQueue
     {
         auto localHead = head_.fetch_add(1);
 
-        while(!(turn(localHead)*2 == data_[idx(localHead)].turn.load()));
+        for(Backoff backoff; !(turn(localHead)*2 == data_[idx(localHead)].turn.load()); backoff());
 
         new (&data_[idx(localHead)].item) T{std::forward<Args>(args)...};
 
         data_[idx(localHead)].turn.store(turn(localHead)*2 + 1);
+        deqWaiters_.wake_all();
     }
 
     template<typename ... Args>
     bool enq(Args&&... args)
     {
         auto localHead = head_.load(std::memory_order_acquire);
+        Backoff backoff;
 
         while(true)
         {
@@ -89,9 +105,11 @@ struct MRMWQueue
                 {
                     new (&data_[idx(localHead)].item) T{std::forward<Args>(args)...};
                     data_[idx(localHead)].turn.store(turn(localHead)*2 + 1);
+                    deqWaiters_.wake_all();
                     if_debug(std::cout << std::format("thread {}: successful enq\n", std::this_thread::get_id()));
                     return true;
                 }
+                backoff();
             }
             else
             {
@@ -112,11 +130,12 @@ struct MRMWQueue
     {
         auto localTail = tail_.fetch_add(1);
 
-        while(!(turn(localTail)*2 + 1 == data_[idx(localTail)].turn.load()));
+        for(Backoff backoff; !(turn(localTail)*2 + 1 == data_[idx(localTail)].turn.load()); backoff());
 
         T res = std::move(data_[idx(localTail)].item);
         data_[idx(localTail)].destroy();
         data_[idx(localTail)].turn.store(turn(localTail)*2 + 2);
+        enqWaiters_.wake_all();
 
         return res;
     }
@@ -124,6 +143,7 @@ struct MRMWQueue
     std::optional<T> deq()
     {
         auto localTail = tail_.load(std::memory_order_acquire);
+        Backoff backoff;
 
         while(true)
         {
@@ -137,9 +157,11 @@ struct MRMWQueue
                                 );
                     data_[idx(localTail)].destroy();
                     data_[idx(localTail)].turn.store(turn(localTail)*2 + 2);
+                    enqWaiters_.wake_all();
                     if_debug(std::cout << std::format("thread {}: successful deq\n", std::this_thread::get_id()));
                     return res;
                 }
+                backoff();
             }
             else
             {
@@ -154,6 +176,29 @@ struct MRMWQueue
         }
     }
 
+    // enq can only construct from an rvalue once it owns a slot, so a failed
+    // attempt leaves item untouched for the retry
+    task<void> async_enq(T item)
+    {
+        while(!enq(std::move(item)))
+        {
+            co_await enqWaiters_.park([this](){ return can_enq(); });
+        }
+    }
+
+    task<T> async_deq()
+    {
+        while(true)
+        {
+            auto res = deq();
+            if(res)
+            {
+                co_return std::move(*res);
+            }
+            co_await deqWaiters_.park([this](){ return can_deq(); });
+        }
+    }
+
     bool empty() const
     {
         return head_.load() == tail_.load();
@@ -161,6 +206,18 @@ struct MRMWQueue
 
 private:
 
+    bool can_enq() const
+    {
+        auto localHead = head_.load();
+        return turn(localHead)*2 == data_[idx(localHead)].turn.load();
+    }
+
+    bool can_deq() const
+    {
+        auto localTail = tail_.load();
+        return turn(localTail)*2 + 1 == data_[idx(localTail)].turn.load();
+    }
+
     static constexpr size_t cacheLineSize = 64;
 
     size_t idx(size_t i) const { return i % capacity_; }
@@ -171,4 +228,6 @@ private:
     std::vector<slot<T>> data_;
     alignas(cacheLineSize) std::atomic<size_t> head_{ 0 };
     alignas(cacheLineSize) std::atomic<size_t> tail_{ 0 };
+    alignas(cacheLineSize) waiter_list enqWaiters_;
+    waiter_list deqWaiters_;
 };
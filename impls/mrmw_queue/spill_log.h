@@ -0,0 +1,174 @@
+#pragma once
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+    FIFO log of T kept in fixed size segment files.
+
+    Each segment is a file created with mkstemp in dir and unlinked straight
+    away, so nothing is left behind if the process dies; we keep only the fd.
+    At most two segments are mapped at a time: the one being written and the one
+    being read. Segments in between sit in the page cache (or in RAM if dir is a
+    tmpfs such as /dev/shm) and are mapped again when the reader gets to them.
+    A segment is closed (freeing its space) as soon as it has been read.
+
+    T is copied bytewise so it must be trivially copyable. Not thread safe.
+*/
+template<typename T>
+struct spill_log
+{
+    static_assert(std::is_trivially_copyable_v<T>,
+            "spilled items are written to disk bytewise");
+
+    explicit spill_log(std::string dir, size_t segment_bytes = size_t{64} << 20)
+        : dir_(std::move(dir)),
+        itemsPerSegment_(std::max<size_t>(1, segment_bytes / sizeof(T)))
+    {}
+
+    spill_log(const spill_log&) = delete;
+    spill_log& operator=(const spill_log&) = delete;
+
+    void push(const T& item)
+    {
+        if(segments_.empty() || segments_.back().written == itemsPerSegment_)
+        {
+            if(segments_.size() > 1)
+            {
+                // the reader does not need the full segment mapped yet
+                unmap(segments_.back());
+            }
+            segments_.push_back(create_segment());
+        }
+
+        segment& back = segments_.back();
+        std::memcpy(&back.data[back.written], &item, sizeof(T));
+        ++back.written;
+        ++size_;
+    }
+
+    const T& front()
+    {
+        segment& s = segments_.front();
+        map(s);
+        return s.data[s.read];
+    }
+
+    void pop()
+    {
+        segment& s = segments_.front();
+        ++s.read;
+        --size_;
+
+        if(s.read == itemsPerSegment_)
+        {
+            destroy(s);
+            segments_.pop_front();
+        }
+        else if(s.read == s.written && segments_.size() == 1)
+        {
+            // fully drained: reuse the file from the start
+            s.read = s.written = 0;
+        }
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    // number of segment files currently holding data
+    size_t segments() const
+    {
+        return segments_.size();
+    }
+
+    ~spill_log()
+    {
+        for(auto& s : segments_)
+        {
+            destroy(s);
+        }
+    }
+
+private:
+    struct segment
+    {
+        int fd;
+        T* data;
+        size_t written;
+        size_t read;
+    };
+
+    size_t segment_bytes() const
+    {
+        return itemsPerSegment_ * sizeof(T);
+    }
+
+    segment create_segment()
+    {
+        std::string path = dir_ + "/mrmw_spill_XXXXXX";
+        int fd = ::mkstemp(path.data());
+        if(fd < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "spill_log: mkstemp " + path);
+        }
+        ::unlink(path.c_str());
+
+        if(::ftruncate(fd, static_cast<off_t>(segment_bytes())) != 0)
+        {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "spill_log: ftruncate");
+        }
+
+        segment s{fd, nullptr, 0, 0};
+        map(s);
+        return s;
+    }
+
+    void map(segment& s)
+    {
+        if(s.data)
+        {
+            return;
+        }
+        void* addr = ::mmap(nullptr, segment_bytes(), PROT_READ | PROT_WRITE, MAP_SHARED, s.fd, 0);
+        if(addr == MAP_FAILED)
+        {
+            throw std::system_error(errno, std::generic_category(), "spill_log: mmap");
+        }
+        s.data = static_cast<T*>(addr);
+    }
+
+    void unmap(segment& s)
+    {
+        if(s.data)
+        {
+            ::munmap(s.data, segment_bytes());
+            s.data = nullptr;
+        }
+    }
+
+    void destroy(segment& s)
+    {
+        unmap(s);
+        ::close(s.fd);
+    }
+
+    std::string dir_;
+    const size_t itemsPerSegment_;
+    std::deque<segment> segments_;
+    size_t size_ = 0;
+};
@@ -0,0 +1,141 @@
+#pragma once
+/*
+    MRMWQueue with an overflow tier on disk.
+
+    When the ring is full, enq appends to a spill_log instead of failing or
+    spinning, so producers never wait on consumers and memory stays at the ring
+    plus two mapped segments.
+
+    Ordering: once anything has been spilled we are in spilling mode and every
+    enq goes to the log until it has been emptied again, so a producer can never
+    put an item in the ring that overtakes one of its own spilled items.
+    Consumers always prefer the ring (anything in it was enqueued before the
+    spilled items of the same producer). When the ring has drained, one
+    consumer replays a batch from the log into the ring under the spill lock,
+    and the last replay turns spilling mode off.
+
+    Only the spill path takes a lock: it is already paying for the disk.
+*/
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <string>
+#include "mrmw_queue.h"
+#include "spill_log.h"
+
+template<typename T>
+struct SpillingMRMWQueue
+{
+    SpillingMRMWQueue(size_t capacity, std::string spill_dir,
+            size_t segment_bytes = size_t{64} << 20)
+        : capacity_(capacity),
+        ring_(capacity),
+        spill_(std::move(spill_dir), segment_bytes)
+    {}
+
+    // never fails: what does not fit in the ring goes to disk
+    template<typename ... Args>
+    bool enq(Args&&... args)
+    {
+        T item{std::forward<Args>(args)...};
+
+        // a failed enq does not consume item
+        if(!spilling_.load(std::memory_order_acquire) && ring_.enq(std::move(item)))
+        {
+            return true;
+        }
+
+        std::unique_lock<std::mutex> lk{spillLock_};
+        if(!spilling_.load(std::memory_order_relaxed))
+        {
+            // the ring may have drained while we were waiting for the lock
+            if(ring_.enq(std::move(item)))
+            {
+                return true;
+            }
+            spilling_.store(true, std::memory_order_release);
+        }
+        spill_.push(item);
+        return true;
+    }
+
+    template<typename ... Args>
+    void force_enq(Args&&... args)
+    {
+        enq(std::forward<Args>(args)...);
+    }
+
+    std::optional<T> deq()
+    {
+        auto res = ring_.deq();
+        if(res || !spilling_.load(std::memory_order_acquire))
+        {
+            return res;
+        }
+
+        std::unique_lock<std::mutex> lk{spillLock_};
+        // ring items are older than the spilled ones: only replay into an
+        // empty ring (a claimed but unpublished slot also counts as non-empty)
+        if(ring_.empty() && !spill_.empty())
+        {
+            replay();
+        }
+        lk.unlock();
+
+        return ring_.deq();
+    }
+
+    T force_deq()
+    {
+        while(true)
+        {
+            auto res = deq();
+            if(res)
+            {
+                return std::move(*res);
+            }
+        }
+    }
+
+    bool empty()
+    {
+        if(!ring_.empty())
+        {
+            return false;
+        }
+        std::unique_lock<std::mutex> lk{spillLock_};
+        return spill_.empty() && ring_.empty();
+    }
+
+    // items currently on disk
+    size_t spilled()
+    {
+        std::unique_lock<std::mutex> lk{spillLock_};
+        return spill_.size();
+    }
+
+private:
+    // holding spillLock_
+    void replay()
+    {
+        for(size_t moved = 0; moved < capacity_ && !spill_.empty(); ++moved)
+        {
+            if(!ring_.enq(spill_.front()))
+            {
+                break;
+            }
+            spill_.pop();
+        }
+
+        if(spill_.empty())
+        {
+            spilling_.store(false, std::memory_order_release);
+        }
+    }
+
+    const size_t capacity_;
+    MRMWQueue<T> ring_;
+    alignas(64) std::atomic<bool> spilling_{ false };
+    std::mutex spillLock_;
+    spill_log<T> spill_;
+};
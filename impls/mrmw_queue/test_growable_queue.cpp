@@ -0,0 +1,170 @@
+#include "growable_queue.h"
+#include "../../exercises/chapter10/test_pool.h"
+#include <chrono>
+#include <format>
+
+void single_threaded_test()
+{
+    GrowableMRMWQueue<int> q(4);
+    assert(q.capacity() == 4);
+
+    // full rings grow on their own: 4 + 8 + 16 + 32 and then 40 of 64
+    for(int i = 0; i < 100; ++i)
+    {
+        assert(q.enq(i));
+    }
+    assert(q.capacity() == 64);
+
+    // items written before the resize come out first
+    assert(q.shrink());
+    q.force_enq(100);
+    for(int i = 0; i <= 100; ++i)
+    {
+        assert(q.force_deq() == i);
+    }
+    assert(q.empty());
+    assert(q.capacity() == 32);
+}
+
+void bounded_test()
+{
+    GrowableMRMWQueue<int> q(4, resize_policy{.min_capacity = 4, .max_capacity = 8});
+
+    // the ring of 4 fills, then the ring of 8, and there is no ring of 16
+    for(int i = 0; i < 12; ++i)
+    {
+        assert(q.enq(i));
+    }
+    assert(!q.enq(12));
+
+    // space in the closed ring of 4 is not reused
+    for(int i = 0; i < 4; ++i)
+    {
+        assert(q.force_deq() == i);
+    }
+    assert(!q.enq(12));
+    assert(q.force_deq() == 4);
+    assert(q.enq(12));
+}
+
+void watermark_test()
+{
+    GrowableMRMWQueue<int> q(16, resize_policy{
+            .high_watermark = 0.75,
+            .low_watermark = 0.125,
+            .min_capacity = 16});
+
+    for(int i = 0; i < 12; ++i)
+    {
+        q.force_enq(i);
+    }
+    // the 12th item put the ring at 75%
+    assert(q.capacity() == 32);
+
+    // draining the closed ring never shrinks anything
+    for(int i = 0; i < 12; ++i)
+    {
+        assert(q.force_deq() == i);
+    }
+    assert(q.capacity() == 32);
+
+    // but dropping under 4 of 32 in the live ring does
+    for(int i = 12; i < 17; ++i)
+    {
+        q.force_enq(i);
+    }
+    for(int i = 12; i < 17; ++i)
+    {
+        assert(q.force_deq() == i);
+    }
+    assert(q.capacity() == 16);
+}
+
+/*
+    Threads enq and deq in pairs, so the ring never holds more than one item
+    per thread, well under the high watermark. By the time an enq checks the
+    fill level, deqs may have moved tail_ past its own slot; that must read as
+    empty, not as a full ring, so the capacity never changes.
+*/
+void nearly_empty_watermark_test()
+{
+    static constexpr int threads = 4;
+    static constexpr int rounds = 100000;
+    GrowableMRMWQueue<int> q(16, resize_policy{.high_watermark = 0.75, .min_capacity = 16});
+
+    std::vector<std::thread> workers;
+    for(int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&q](){
+            for(int i = 0; i < rounds; ++i)
+            {
+                q.force_enq(i);
+                q.force_deq();
+            }
+        });
+    }
+    for(auto& th : workers)
+    {
+        th.join();
+    }
+    assert(q.empty());
+    assert(q.capacity() == 16);
+}
+
+/*
+    Producers and consumers running while another thread keeps flipping the
+    capacity between small and large rings.
+*/
+void resize_under_load_test()
+{
+    GrowableMRMWQueue<int> q(64, resize_policy{.min_capacity = 16, .max_capacity = 1 << 12});
+    std::atomic<bool> done{ false };
+
+    std::thread resizer([&q, &done](){
+        bool up = true;
+        while(!done.load())
+        {
+            up ? q.grow() : q.shrink();
+            up = !up;
+            std::this_thread::yield();
+        }
+    });
+
+    test_pool(q);
+
+    done.store(true);
+    resizer.join();
+}
+
+void resize_benchmark()
+{
+    static constexpr size_t items = 1 << 20;
+    for(size_t start : {size_t{16}, items})
+    {
+        GrowableMRMWQueue<int> q(start);
+        auto start_time = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < items; ++i)
+        {
+            q.force_enq(static_cast<int>(i));
+        }
+        for(size_t i = 0; i < items; ++i)
+        {
+            q.force_deq();
+        }
+        auto total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start_time);
+
+        std::cout << std::format("starting capacity {}: {}ns per enq/deq pair\n",
+                start, (total_time / items).count());
+    }
+}
+
+int main()
+{
+    single_threaded_test();
+    bounded_test();
+    watermark_test();
+    nearly_empty_watermark_test();
+    resize_under_load_test();
+    resize_benchmark();
+}
@@ -0,0 +1,194 @@
+#include "lane_queue.h"
+#include "../../exercises/chapter10/test_pool.h"
+#include <chrono>
+#include <format>
+
+void strict_test()
+{
+    LaneQueue<int, 4> q(16);
+    assert(q.empty());
+
+    for(int lane = 3; lane >= 0; --lane)
+    {
+        q.force_enq(lane, lane * 10);
+        q.force_enq(lane, lane * 10 + 1);
+    }
+
+    for(int lane = 0; lane < 4; ++lane)
+    {
+        size_t from;
+        assert(*q.deq(from) == lane * 10 && from == static_cast<size_t>(lane));
+        assert(*q.deq(from) == lane * 10 + 1 && from == static_cast<size_t>(lane));
+    }
+    assert(!q.deq().has_value());
+    assert(q.empty());
+}
+
+void weighted_test()
+{
+    LaneQueue<int, 2> q(64, {3, 1});
+    for(int i = 0; i < 40; ++i)
+    {
+        q.force_enq(0, i);
+        q.force_enq(1, i);
+    }
+
+    // the low priority lane is not starved: one in every four deqs
+    std::array<size_t, 2> counts{};
+    for(int i = 0; i < 40; ++i)
+    {
+        size_t from;
+        assert(q.deq(from).has_value());
+        ++counts[from];
+    }
+    assert(counts[0] == 30 && counts[1] == 10);
+
+    // once lane 0 runs dry its turns fall through to lane 1; each lane stays FIFO
+    std::array<int, 2> next{30, 10};
+    for(int i = 0; i < 40; ++i)
+    {
+        size_t from;
+        auto x = q.deq(from);
+        assert(x.has_value() && *x == next[from]);
+        ++next[from];
+    }
+    assert(next[0] == 40 && next[1] == 40);
+    assert(q.empty());
+}
+
+// one thread taking turns between two queues still gets each queue's ratio
+void two_queue_weighted_test()
+{
+    LaneQueue<int, 2> a(64, {3, 1});
+    LaneQueue<int, 2> b(64, {1, 1});
+    for(int i = 0; i < 40; ++i)
+    {
+        a.force_enq(0, i);
+        a.force_enq(1, i);
+        b.force_enq(0, i);
+        b.force_enq(1, i);
+    }
+
+    std::array<size_t, 2> countsA{}, countsB{};
+    for(int i = 0; i < 40; ++i)
+    {
+        size_t from;
+        assert(a.deq(from).has_value());
+        ++countsA[from];
+        assert(b.deq(from).has_value());
+        ++countsB[from];
+    }
+    assert(countsA[0] == 30 && countsA[1] == 10);
+    assert(countsB[0] == 20 && countsB[1] == 20);
+}
+
+// lets test_pool drive a LaneQueue: the value picks the lane
+template<typename Q, size_t Lanes>
+struct spread_lanes
+{
+    bool enq(int x) { return q.enq(static_cast<size_t>(x) % Lanes, x); }
+    std::optional<int> deq() { return q.deq(); }
+    bool empty() { return q.empty(); }
+    Q& q;
+};
+
+struct timed_item
+{
+    long long enq_time_ns;
+};
+
+template<>
+struct queue_traits<timed_item>
+{
+    static timed_item empty_value() { return {0}; }
+};
+
+long long now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+    Control traffic (lane 0, 1%), interactive (lane 1, 9%) and bulk (lane 2,
+    90%) from several producers into a queue that consumers cannot quite keep
+    up with. Reports the mean enq -> deq latency of each lane.
+*/
+template<size_t Lanes>
+void mixed_load_benchmark(const char* name, LaneQueue<timed_item, Lanes>& q)
+{
+    static constexpr size_t producers = 4, consumers = 2, per_producer = 50000;
+    std::atomic<size_t> remaining{ producers * per_producer };
+    std::vector<std::array<long long, Lanes>> total_ns(consumers), count(consumers);
+    std::vector<std::thread> threads;
+
+    for(size_t p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&q, p](){
+            for(size_t i = 0; i < per_producer; ++i)
+            {
+                size_t r = (i * 7919 + p) % 100;
+                size_t lane = r == 0 ? 0 : (r < 10 ? 1 : 2);
+                while(!q.enq(lane, timed_item{now_ns()}))
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for(size_t c = 0; c < consumers; ++c)
+    {
+        threads.emplace_back([&, c](){
+            total_ns[c] = {};
+            count[c] = {};
+            while(remaining.load(std::memory_order_relaxed) > 0)
+            {
+                size_t lane;
+                auto item = q.deq(lane);
+                if(item)
+                {
+                    total_ns[c][lane] += now_ns() - item->enq_time_ns;
+                    ++count[c][lane];
+                    remaining.fetch_sub(1, std::memory_order_relaxed);
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for(auto& th : threads)
+    {
+        th.join();
+    }
+
+    std::cout << name << ":";
+    for(size_t lane = 0; lane < Lanes; ++lane)
+    {
+        long long ns = 0, n = 0;
+        for(size_t c = 0; c < consumers; ++c)
+        {
+            ns += total_ns[c][lane];
+            n += count[c][lane];
+        }
+        std::cout << std::format(" lane {} {}ns", lane, n ? ns / n : 0);
+    }
+    std::cout << "\n";
+}
+
+int main()
+{
+    strict_test();
+    weighted_test();
+    two_queue_weighted_test();
+
+    LaneQueue<int, 4> q(256);
+    test_pool(spread_lanes<LaneQueue<int, 4>, 4>{q});
+    assert(q.empty());
+
+    LaneQueue<timed_item, 3> strict(1024);
+    mixed_load_benchmark("strict", strict);
+    LaneQueue<timed_item, 3> weighted(1024, {8, 4, 1});
+    mixed_load_benchmark("weighted 8/4/1", weighted);
+}
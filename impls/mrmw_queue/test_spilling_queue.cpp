@@ -0,0 +1,85 @@
+#include "spilling_queue.h"
+#include "../../exercises/chapter10/test_pool.h"
+#include <filesystem>
+
+// tmpfs if we have one, so the tests never touch a real disk
+std::string spill_dir()
+{
+    return std::filesystem::exists("/dev/shm") ? "/dev/shm" : "/tmp";
+}
+
+void single_threaded_test()
+{
+    // 16 ints per segment so we go through plenty of segment files
+    SpillingMRMWQueue<int> q(4, spill_dir(), 16 * sizeof(int));
+
+    for(int i = 0; i < 1000; ++i)
+    {
+        assert(q.enq(i));
+    }
+    assert(q.spilled() == 996);
+
+    for(int i = 0; i < 500; ++i)
+    {
+        assert(q.force_deq() == i);
+    }
+
+    // still spilling: new items queue up behind the spilled ones
+    q.enq(1000);
+    for(int i = 500; i <= 1000; ++i)
+    {
+        assert(q.force_deq() == i);
+    }
+    assert(q.empty());
+    assert(q.spilled() == 0);
+
+    // and once drained the ring is used directly again
+    q.enq(7);
+    assert(q.spilled() == 0);
+    assert(q.force_deq() == 7);
+}
+
+/*
+    Several producers, one consumer: the consumer must see every producer's
+    items in the order that producer enqueued them.
+*/
+void per_producer_order_test()
+{
+    static constexpr int producers = 4, per_producer = 100000;
+    SpillingMRMWQueue<int> q(64, spill_dir(), 4096);
+    std::vector<std::thread> threads;
+
+    for(int p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&q, p](){
+            for(int i = 0; i < per_producer; ++i)
+            {
+                q.enq(p * per_producer + i);
+            }
+        });
+    }
+
+    std::vector<int> next(producers, 0);
+    for(int received = 0; received < producers * per_producer; ++received)
+    {
+        int x = q.force_deq();
+        int p = x / per_producer;
+        assert(x % per_producer == next[p]);
+        ++next[p];
+    }
+
+    for(auto& th : threads)
+    {
+        th.join();
+    }
+    assert(q.empty());
+}
+
+int main()
+{
+    single_threaded_test();
+    per_producer_order_test();
+
+    SpillingMRMWQueue<int> q(16, spill_dir(), 4096);
+    test_pool(q);
+}
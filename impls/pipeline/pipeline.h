@@ -0,0 +1,527 @@
+#pragma once
+/*
+    Pipelines of worker pools connected by bounded queues.
+
+        auto p = pipeline::source(1, gen)
+               | pipeline::map(4, f)
+               | pipeline::batch(64)
+               | pipeline::sink(2, g);
+        p.run();
+        for(auto& s : p.stats()) ...
+
+    Every stage runs its own workers. Stages hand items to each other in
+    batches of options::batch_size (one queue operation per batch instead of
+    per item), through a channel of options::channel_batches batches. A full
+    channel makes the producing stage wait, so backpressure travels up the
+    pipeline without anything extra.
+
+    A channel between two single worker stages is an spsc_ring, anything else
+    is an MRMWQueue. Both carry batch pointers, so the rings stay trivially
+    copyable and a batch changes owner with one pointer write.
+
+    Stage signatures:
+        source: std::optional<T> gen(size_t worker)  - nullopt when that worker is done
+        map:    U f(T)
+        batch:  groups T into std::vector<T> of a given size (the tail may be short)
+        sink:   void f(T)
+    Functions are shared by the workers of a stage and must be thread safe.
+*/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "../mrmw_queue/mrmw_queue.h"
+#include "spsc_ring.h"
+
+namespace pipeline
+{
+struct options
+{
+    size_t batch_size = 256;
+    size_t channel_batches = 64;
+};
+
+struct stage_stats
+{
+    std::string name;
+    size_t workers;
+    size_t items;
+    double seconds;
+    // of the stage's input channel, in batches, sampled on every pop
+    size_t max_depth;
+    double mean_depth;
+
+    double items_per_second() const
+    {
+        return seconds > 0 ? items / seconds : 0;
+    }
+};
+
+struct channel_base
+{
+    virtual ~channel_base() = default;
+};
+
+template<typename T>
+struct channel : channel_base
+{
+    using batch_type = std::vector<T>;
+
+    channel(size_t capacity, size_t producers, size_t consumers)
+        : producersLeft_(producers)
+    {
+        if(producers == 1 && consumers == 1)
+        {
+            spsc_ = std::make_unique<spsc_ring<batch_type*>>(capacity);
+        }
+        else
+        {
+            mrmw_ = std::make_unique<MRMWQueue<batch_type*>>(capacity);
+        }
+    }
+
+    // waits while the channel is full: this is the backpressure
+    void push(batch_type* b)
+    {
+        while(!(spsc_ ? spsc_->push(b) : mrmw_->enq(b)))
+        {
+            std::this_thread::yield();
+        }
+        depth_.fetch_add(1, std::memory_order_release);
+    }
+
+    // nullptr if there is nothing right now
+    batch_type* pop()
+    {
+        auto res = spsc_ ? spsc_->pop() : mrmw_->deq();
+        if(!res)
+        {
+            return nullptr;
+        }
+        depth_.fetch_sub(1, std::memory_order_relaxed);
+        return *res;
+    }
+
+    void producer_done()
+    {
+        producersLeft_.fetch_sub(1, std::memory_order_release);
+    }
+
+    // every producer is done and everything they pushed has been popped
+    bool finished() const
+    {
+        return producersLeft_.load(std::memory_order_acquire) == 0 &&
+            depth_.load(std::memory_order_acquire) == 0;
+    }
+
+    size_t depth() const
+    {
+        return static_cast<size_t>(std::max<long>(0, depth_.load(std::memory_order_relaxed)));
+    }
+
+    ~channel()
+    {
+        while(batch_type* b = pop())
+        {
+            delete b;
+        }
+    }
+
+private:
+    std::unique_ptr<spsc_ring<batch_type*>> spsc_;
+    std::unique_ptr<MRMWQueue<batch_type*>> mrmw_;
+    std::atomic<size_t> producersLeft_;
+    alignas(64) std::atomic<long> depth_{ 0 };
+};
+
+/*
+    Per worker output buffer: fills a batch and hands it on when full.
+*/
+template<typename T>
+struct emitter
+{
+    emitter(channel<T>* out, size_t batch_size)
+        : out_(out), batchSize_(batch_size)
+    {}
+
+    template<typename U>
+    void push(U&& item)
+    {
+        if(!curr_)
+        {
+            curr_ = new std::vector<T>;
+            curr_->reserve(batchSize_);
+        }
+        curr_->push_back(std::forward<U>(item));
+        if(curr_->size() == batchSize_)
+        {
+            out_->push(std::exchange(curr_, nullptr));
+        }
+    }
+
+    void flush()
+    {
+        if(curr_)
+        {
+            out_->push(std::exchange(curr_, nullptr));
+        }
+    }
+
+private:
+    channel<T>* out_;
+    size_t batchSize_;
+    std::vector<T>* curr_ = nullptr;
+};
+
+struct stage_base
+{
+    stage_base(std::string name, size_t workers)
+        : name_(std::move(name)), workers_(workers)
+    {}
+    virtual ~stage_base() = default;
+
+    void start(const options& opts)
+    {
+        start_ = std::chrono::steady_clock::now();
+        for(size_t w = 0; w < workers_; ++w)
+        {
+            threads_.emplace_back([this, w, opts](){
+                worker_stats local{};
+                work(w, opts, local);
+                finish_worker(local);
+            });
+        }
+    }
+
+    void join()
+    {
+        for(auto& th : threads_)
+        {
+            th.join();
+        }
+        threads_.clear();
+    }
+
+    stage_stats stats() const
+    {
+        std::chrono::duration<double> elapsed = end_ - start_;
+        return {name_, workers_, items_, elapsed.count(), maxDepth_,
+            depthSamples_ ? static_cast<double>(depthSum_) / depthSamples_ : 0.0};
+    }
+
+protected:
+    struct worker_stats
+    {
+        size_t items;
+        size_t maxDepth;
+        size_t depthSum;
+        size_t depthSamples;
+    };
+
+    virtual void work(size_t worker, const options& opts, worker_stats& local) = 0;
+
+    /*
+        Pops batches from in until it is finished, calling on_batch for each.
+    */
+    template<typename In, typename F>
+    static void consume(channel<In>* in, worker_stats& local, F&& on_batch)
+    {
+        while(true)
+        {
+            size_t depth = in->depth();
+            auto* b = in->pop();
+            if(!b)
+            {
+                if(in->finished())
+                {
+                    return;
+                }
+                std::this_thread::yield();
+                continue;
+            }
+
+            local.maxDepth = std::max(local.maxDepth, depth);
+            local.depthSum += depth;
+            ++local.depthSamples;
+
+            on_batch(*b);
+            delete b;
+        }
+    }
+
+private:
+    void finish_worker(const worker_stats& local)
+    {
+        std::unique_lock<std::mutex> lk{statsLock_};
+        items_ += local.items;
+        maxDepth_ = std::max(maxDepth_, local.maxDepth);
+        depthSum_ += local.depthSum;
+        depthSamples_ += local.depthSamples;
+        if(++finished_ == workers_)
+        {
+            end_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    std::string name_;
+    size_t workers_;
+    std::vector<std::thread> threads_;
+    std::chrono::steady_clock::time_point start_, end_;
+    std::mutex statsLock_;
+    size_t finished_ = 0;
+    size_t items_ = 0;
+    size_t maxDepth_ = 0;
+    size_t depthSum_ = 0;
+    size_t depthSamples_ = 0;
+};
+
+template<typename Out>
+struct output_stage : stage_base
+{
+    using stage_base::stage_base;
+    channel<Out>* out = nullptr;
+};
+
+template<typename Out, typename Gen>
+struct source_stage : output_stage<Out>
+{
+    source_stage(size_t workers, Gen gen)
+        : output_stage<Out>("source", workers), gen_(std::move(gen))
+    {}
+
+    void work(size_t worker, const options& opts, stage_base::worker_stats& local) override
+    {
+        emitter<Out> emit{this->out, opts.batch_size};
+        while(auto item = gen_(worker))
+        {
+            emit.push(std::move(*item));
+            ++local.items;
+        }
+        emit.flush();
+        this->out->producer_done();
+    }
+
+private:
+    Gen gen_;
+};
+
+template<typename In, typename Out, typename F>
+struct map_stage : output_stage<Out>
+{
+    map_stage(size_t workers, F f)
+        : output_stage<Out>("map", workers), f_(std::move(f))
+    {}
+
+    void work(size_t, const options& opts, stage_base::worker_stats& local) override
+    {
+        emitter<Out> emit{this->out, opts.batch_size};
+        stage_base::consume(in, local, [&](std::vector<In>& b){
+            for(auto& item : b)
+            {
+                emit.push(f_(std::move(item)));
+            }
+            local.items += b.size();
+        });
+        emit.flush();
+        this->out->producer_done();
+    }
+
+    channel<In>* in = nullptr;
+
+private:
+    F f_;
+};
+
+template<typename In>
+struct batch_stage : output_stage<std::vector<In>>
+{
+    batch_stage(size_t workers, size_t size)
+        : output_stage<std::vector<In>>("batch", workers), size_(size)
+    {}
+
+    void work(size_t, const options& opts, stage_base::worker_stats& local) override
+    {
+        emitter<std::vector<In>> emit{this->out, opts.batch_size};
+        std::vector<In> group;
+        group.reserve(size_);
+
+        stage_base::consume(in, local, [&](std::vector<In>& b){
+            for(auto& item : b)
+            {
+                group.push_back(std::move(item));
+                if(group.size() == size_)
+                {
+                    emit.push(std::move(group));
+                    group.clear();
+                    group.reserve(size_);
+                }
+            }
+            local.items += b.size();
+        });
+
+        if(!group.empty())
+        {
+            emit.push(std::move(group));
+        }
+        emit.flush();
+        this->out->producer_done();
+    }
+
+    channel<In>* in = nullptr;
+
+private:
+    size_t size_;
+};
+
+template<typename In, typename F>
+struct sink_stage : stage_base
+{
+    sink_stage(size_t workers, F f)
+        : stage_base("sink", workers), f_(std::move(f))
+    {}
+
+    void work(size_t, const options&, worker_stats& local) override
+    {
+        consume(in, local, [&](std::vector<In>& b){
+            for(auto& item : b)
+            {
+                f_(std::move(item));
+            }
+            local.items += b.size();
+        });
+    }
+
+    channel<In>* in = nullptr;
+
+private:
+    F f_;
+};
+
+/*
+    A finished pipeline: everything from source to sink.
+*/
+struct chain
+{
+    void run()
+    {
+        for(auto& s : stages_)
+        {
+            s->start(opts_);
+        }
+        for(auto& s : stages_)
+        {
+            s->join();
+        }
+    }
+
+    std::vector<stage_stats> stats() const
+    {
+        std::vector<stage_stats> res;
+        for(auto& s : stages_)
+        {
+            res.push_back(s->stats());
+        }
+        return res;
+    }
+
+    options opts_;
+    std::vector<std::unique_ptr<stage_base>> stages_;
+    std::vector<std::unique_ptr<channel_base>> channels_;
+};
+
+/*
+    A pipeline still missing its sink. Out is the item type of the last stage.
+*/
+template<typename Out>
+struct builder
+{
+    options opts;
+    std::vector<std::unique_ptr<stage_base>> stages;
+    std::vector<std::unique_ptr<channel_base>> channels;
+    output_stage<Out>* last;
+    size_t lastWorkers;
+
+    // a new channel from the last stage to a stage with `consumers` workers
+    channel<Out>* connect(size_t consumers)
+    {
+        auto ch = std::make_unique<channel<Out>>(opts.channel_batches, lastWorkers, consumers);
+        last->out = ch.get();
+        channels.push_back(std::move(ch));
+        return last->out;
+    }
+
+    template<typename Next>
+    builder<Next> extend(std::unique_ptr<output_stage<Next>> next, size_t workers)
+    {
+        auto* raw = next.get();
+        stages.push_back(std::move(next));
+        return {opts, std::move(stages), std::move(channels), raw, workers};
+    }
+};
+
+template<typename F> struct map_spec { size_t workers; F f; };
+template<typename F> struct sink_spec { size_t workers; F f; };
+struct batch_spec { size_t workers; size_t size; };
+
+template<typename Gen>
+auto source(size_t workers, Gen gen, options opts = options{})
+{
+    using Out = typename std::invoke_result_t<Gen&, size_t>::value_type;
+    auto stage = std::make_unique<source_stage<Out, Gen>>(workers, std::move(gen));
+    auto* raw = stage.get();
+
+    builder<Out> b{opts, {}, {}, raw, workers};
+    b.stages.push_back(std::move(stage));
+    return b;
+}
+
+template<typename F>
+map_spec<F> map(size_t workers, F f)
+{
+    return {workers, std::move(f)};
+}
+
+inline batch_spec batch(size_t size, size_t workers = 1)
+{
+    return {workers, size};
+}
+
+template<typename F>
+sink_spec<F> sink(size_t workers, F f)
+{
+    return {workers, std::move(f)};
+}
+
+template<typename In, typename F>
+auto operator|(builder<In>&& b, map_spec<F> spec)
+{
+    using Out = std::decay_t<std::invoke_result_t<F&, In&&>>;
+    auto stage = std::make_unique<map_stage<In, Out, F>>(spec.workers, std::move(spec.f));
+    stage->in = b.connect(spec.workers);
+    return b.template extend<Out>(std::move(stage), spec.workers);
+}
+
+template<typename In>
+auto operator|(builder<In>&& b, batch_spec spec)
+{
+    auto stage = std::make_unique<batch_stage<In>>(spec.workers, spec.size);
+    stage->in = b.connect(spec.workers);
+    return b.template extend<std::vector<In>>(std::move(stage), spec.workers);
+}
+
+template<typename In, typename F>
+chain operator|(builder<In>&& b, sink_spec<F> spec)
+{
+    auto stage = std::make_unique<sink_stage<In, F>>(spec.workers, std::move(spec.f));
+    stage->in = b.connect(spec.workers);
+    b.stages.push_back(std::move(stage));
+    return {b.opts, std::move(b.stages), std::move(b.channels)};
+}
+} // namespace pipeline
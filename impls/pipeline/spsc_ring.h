@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <optional>
+#include <vector>
+
+/*
+    Single producer single consumer ring (Lamport).
+
+    Each side owns its own index and keeps a cached copy of the other side's,
+    only re-reading the shared one when the cached copy says full / empty. In
+    the steady state a push or pop touches no cache line the other side writes.
+
+    Capacity is rounded up to a power of two. T must be default constructible.
+*/
+template<typename T>
+struct spsc_ring
+{
+    explicit spsc_ring(size_t capacity)
+        : mask_(std::bit_ceil(capacity) - 1), data_(mask_ + 1)
+    {}
+
+    bool push(T item)
+    {
+        auto localTail = tail_.load(std::memory_order_relaxed);
+        if(localTail - cachedHead_ == data_.size())
+        {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+            if(localTail - cachedHead_ == data_.size())
+            {
+                return false;
+            }
+        }
+
+        data_[localTail & mask_] = std::move(item);
+        tail_.store(localTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::optional<T> pop()
+    {
+        auto localHead = head_.load(std::memory_order_relaxed);
+        if(localHead == cachedTail_)
+        {
+            cachedTail_ = tail_.load(std::memory_order_acquire);
+            if(localHead == cachedTail_)
+            {
+                return std::nullopt;
+            }
+        }
+
+        std::optional<T> res{std::move(data_[localHead & mask_])};
+        head_.store(localHead + 1, std::memory_order_release);
+        return res;
+    }
+
+    // approximate when called concurrently with push / pop
+    size_t size() const
+    {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+private:
+    static constexpr size_t cacheLineSize = 64;
+
+    const size_t mask_;
+    std::vector<T> data_;
+    // producer side
+    alignas(cacheLineSize) std::atomic<size_t> tail_{ 0 };
+    size_t cachedHead_ = 0;
+    // consumer side
+    alignas(cacheLineSize) std::atomic<size_t> head_{ 0 };
+    size_t cachedTail_ = 0;
+};
@@ -0,0 +1,111 @@
+#include "pipeline.h"
+#include <cassert>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+
+// items [0, n) split over the source workers
+auto counting_source(size_t n, size_t workers)
+{
+    return [n, workers, next = std::vector<size_t>(workers, 0)](size_t worker) mutable
+        -> std::optional<long> {
+        size_t i = worker + workers * next[worker]++;
+        if(i >= n)
+        {
+            return std::nullopt;
+        }
+        return static_cast<long>(i);
+    };
+}
+
+void print_stats(const pipeline::chain& p)
+{
+    for(auto& s : p.stats())
+    {
+        std::cout << std::format("  {} x{}: {} items, {} items/s, input depth max {} mean {}\n",
+                s.name, s.workers, s.items, static_cast<long>(s.items_per_second()),
+                s.max_depth, static_cast<long>(s.mean_depth));
+    }
+}
+
+/*
+    Sum of squares through several worker counts, so that both the spsc and the
+    MRMW channels get used, and with a tiny channel so producers hit
+    backpressure constantly.
+*/
+void correctness_test(size_t source_workers, size_t map_workers, size_t sink_workers)
+{
+    static constexpr size_t n = 200000;
+    std::atomic<long> sum{ 0 };
+    std::atomic<size_t> groups{ 0 };
+
+    auto p = pipeline::source(source_workers, counting_source(n, source_workers),
+                pipeline::options{.batch_size = 16, .channel_batches = 2})
+        | pipeline::map(map_workers, [](long x){ return x * x; })
+        | pipeline::batch(10)
+        | pipeline::sink(sink_workers, [&sum, &groups](std::vector<long> group){
+                long local = 0;
+                for(auto x : group)
+                {
+                    local += x;
+                }
+                sum.fetch_add(local);
+                groups.fetch_add(1);
+            });
+    p.run();
+
+    long expected = 0;
+    for(size_t i = 0; i < n; ++i)
+    {
+        expected += static_cast<long>(i * i);
+    }
+    assert(sum.load() == expected);
+    assert(groups.load() == n / 10);
+
+    auto stats = p.stats();
+    assert(stats.size() == 4);
+    for(size_t i = 0; i < 3; ++i)
+    {
+        assert(stats[i].items == n);
+    }
+    assert(stats[3].items == n / 10);
+}
+
+/*
+    source -> map -> batch -> sink over `records` records.
+*/
+void end_to_end_benchmark(size_t records)
+{
+    std::atomic<long> checksum{ 0 };
+
+    auto p = pipeline::source(1, counting_source(records, 1))
+        | pipeline::map(2, [](long x){ return x ^ (x >> 3); })
+        | pipeline::batch(64)
+        | pipeline::sink(1, [&checksum](std::vector<long> group){
+                long local = 0;
+                for(auto x : group)
+                {
+                    local += x;
+                }
+                checksum.fetch_add(local, std::memory_order_relaxed);
+            });
+
+    auto start_time = std::chrono::steady_clock::now();
+    p.run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+
+    std::cout << std::format("{} records in {}ms ({} Mrecords/s)\n", records,
+            static_cast<long>(elapsed.count() * 1000),
+            static_cast<long>(records / elapsed.count() / 1e6));
+    print_stats(p);
+}
+
+int main(int argc, char** argv)
+{
+    correctness_test(1, 1, 1);
+    correctness_test(2, 3, 2);
+    correctness_test(4, 1, 1);
+
+    size_t records = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100'000'000;
+    end_to_end_benchmark(records);
+}
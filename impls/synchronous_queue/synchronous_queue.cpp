@@ -1,11 +1,22 @@
-#include <mutex>
-#include <optional>
+#include "synchronous_queue.h"
+#include "../../exercises/chapter10/test_pool.h"
+#include <cassert>
+#include <chrono>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
 
+/*
+    The old implementation, kept as the baseline for the benchmark: one mutex,
+    one condition variable shared by everybody, and at most one enq in flight.
+*/
 template<typename T>
-struct SynchronousQueue
+struct LockingSynchronousQueue
 {
     std::optional<T> _item;
-    bool enqueuing;
+    bool enqueuing = false;
     std::condition_variable cv;
     std::mutex lock;
 
@@ -37,7 +48,266 @@ struct SynchronousQueue
     }
 };
 
+template<typename Queue>
+void ordered_handoff_test()
+{
+    static constexpr int items = 10000;
+    Queue Q;
+
+    std::thread producer([&Q](){
+        for(int i = 0; i < items; ++i)
+        {
+            Q.enq(i);
+        }
+    });
+    for(int i = 0; i < items; ++i)
+    {
+        assert(Q.deq() == i);
+    }
+    producer.join();
+}
+
+template<typename Queue>
+void many_to_many_test()
+{
+    static constexpr int per_producer = 5000;
+
+    Queue Q;
+    producer_consumer_test(4, 4, per_producer,
+        [&Q](int p){
+            for(int i = 0; i < per_producer; ++i)
+            {
+                Q.enq(p * per_producer + i);
+            }
+        },
+        [&Q](int, std::vector<int>& out){
+            out.push_back(Q.deq());
+        },
+        drain_mode::equal_shares);
+}
+
+/*
+    Park consumers one at a time, then feed them: the fair queue serves them
+    in arrival order, the unfair one latest first.
+*/
+template<bool Fair>
+void fairness_test()
+{
+    static constexpr int consumers = 4;
+    SynchronousQueue<int, Fair> Q;
+    std::vector<int> got(consumers, -1);
+    std::vector<std::thread> threads;
+
+    for(int c = 0; c < consumers; ++c)
+    {
+        threads.emplace_back([&Q, &got, c](){
+            got[c] = Q.deq();
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+    }
+    for(int i = 0; i < consumers; ++i)
+    {
+        Q.enq(i);
+    }
+    for(auto& th : threads)
+    {
+        th.join();
+    }
+
+    for(int c = 0; c < consumers; ++c)
+    {
+        assert(got[c] == (Fair ? c : consumers - 1 - c));
+    }
+}
+
+template<bool Fair>
+void move_only_test()
+{
+    SynchronousQueue<std::unique_ptr<int>, Fair> Q;
+    std::thread producer([&Q](){
+        Q.enq(std::make_unique<int>(7));
+    });
+    assert(*Q.deq() == 7);
+    producer.join();
+}
+
+template<bool Fair>
+void non_blocking_test()
+{
+    using namespace std::chrono_literals;
+    SynchronousQueue<std::unique_ptr<int>, Fair> Q;
+
+    // nobody on the other side
+    assert(!Q.try_poll().has_value());
+    auto item = std::make_unique<int>(1);
+    assert(!Q.try_offer(std::move(item)));
+    assert(item && *item == 1);
+
+    auto start = std::chrono::steady_clock::now();
+    assert(!Q.poll(20ms).has_value());
+    assert(!Q.offer(std::move(item), 20ms));
+    assert(item && *item == 1);
+    assert(std::chrono::steady_clock::now() - start >= 40ms);
+
+    // a parked consumer makes try_offer succeed
+    std::thread consumer([&Q](){
+        assert(*Q.deq() == 1);
+    });
+    while(!Q.try_offer(std::move(item)))
+    {
+        std::this_thread::sleep_for(1ms);
+    }
+    assert(!item);
+    consumer.join();
+
+    // and a parked producer makes try_poll succeed
+    std::thread producer([&Q](){
+        Q.enq(std::make_unique<int>(2));
+    });
+    std::optional<std::unique_ptr<int>> got;
+    while(!(got = Q.try_poll()))
+    {
+        std::this_thread::sleep_for(1ms);
+    }
+    assert(**got == 2);
+    producer.join();
+
+    // the timed out reservations above must not get in the way
+    std::thread late([&Q](){
+        assert(*Q.poll(1s).value() == 3);
+    });
+    assert(Q.offer(std::make_unique<int>(3), 1s));
+    late.join();
+}
+
+/*
+    Producers and consumers with tiny timeouts, so most reservations get
+    cancelled: every value still arrives exactly once.
+*/
+template<bool Fair>
+void timeout_stress_test()
+{
+    using namespace std::chrono_literals;
+    static constexpr int per_producer = 500;
+
+    SynchronousQueue<std::unique_ptr<int>, Fair> Q;
+    producer_consumer_test(4, 4, per_producer,
+        [&Q](int p){
+            for(int i = 0; i < per_producer; ++i)
+            {
+                auto item = std::make_unique<int>(p * per_producer + i);
+                while(!(i % 2 ? Q.try_offer(std::move(item)) : Q.offer(std::move(item), 50us)))
+                {
+                    assert(item);
+                }
+            }
+        },
+        [&Q](int c, std::vector<int>& out){
+            auto got = c % 2 ? Q.try_poll() : Q.poll(50us);
+            if(got)
+            {
+                out.push_back(**got);
+            }
+        });
+}
+
+/*
+    Latency: two threads bounce a token through a pair of queues; every round
+    trip is two hand-offs.
+*/
+template<typename Queue>
+long long ns_per_round_trip()
+{
+    static constexpr int rounds = 20000;
+    Queue ping, pong;
+
+    auto start_time = std::chrono::steady_clock::now();
+    std::thread echo([&](){
+        for(int i = 0; i < rounds; ++i)
+        {
+            pong.enq(ping.deq());
+        }
+    });
+    for(int i = 0; i < rounds; ++i)
+    {
+        ping.enq(i);
+        pong.deq();
+    }
+    echo.join();
+    auto total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_time);
+
+    return (total_time / rounds).count();
+}
+
+/*
+    Throughput: n producers and n consumers hammering one queue.
+*/
+template<typename Queue>
+long long ns_per_handoff(size_t n)
+{
+    static constexpr size_t total = 1 << 16;
+    const size_t per_thread = total / n;
+    Queue Q;
+    std::vector<std::thread> threads;
+
+    auto start_time = std::chrono::steady_clock::now();
+    for(size_t t = 0; t < n; ++t)
+    {
+        threads.emplace_back([&Q, per_thread](){
+            for(size_t i = 0; i < per_thread; ++i)
+            {
+                Q.enq(static_cast<int>(i));
+            }
+        });
+        threads.emplace_back([&Q, per_thread](){
+            for(size_t i = 0; i < per_thread; ++i)
+            {
+                Q.deq();
+            }
+        });
+    }
+    for(auto& th : threads)
+    {
+        th.join();
+    }
+    auto total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_time);
+
+    return (total_time / (per_thread * n)).count();
+}
+
+void benchmark()
+{
+    std::cout << std::format("round trip: locking {}ns, fair {}ns, unfair {}ns\n",
+            ns_per_round_trip<LockingSynchronousQueue<int>>(),
+            ns_per_round_trip<SynchronousQueue<int, true>>(),
+            ns_per_round_trip<SynchronousQueue<int, false>>());
+
+    for(size_t n = 1; n <= 16; n *= 2)
+    {
+        std::cout << std::format("{} producers / {} consumers: locking {}ns/handoff, fair {}ns/handoff, unfair {}ns/handoff\n",
+                n, n,
+                ns_per_handoff<LockingSynchronousQueue<int>>(n),
+                ns_per_handoff<SynchronousQueue<int, true>>(n),
+                ns_per_handoff<SynchronousQueue<int, false>>(n));
+    }
+}
+
 int main()
 {
+    ordered_handoff_test<SynchronousQueue<int, true>>();
+    ordered_handoff_test<SynchronousQueue<int, false>>();
+    many_to_many_test<SynchronousQueue<int, true>>();
+    many_to_many_test<SynchronousQueue<int, false>>();
+    fairness_test<true>();
+    fairness_test<false>();
+    move_only_test<true>();
+    move_only_test<false>();
+    non_blocking_test<true>();
+    non_blocking_test<false>();
+    timeout_stress_test<true>();
+    timeout_stress_test<false>();
 
+    benchmark();
 }
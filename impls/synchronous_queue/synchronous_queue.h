@@ -0,0 +1,699 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include "../hazard_pointer/hazard_pointer.h"
+
+/*
+    Synchronous queue built on dual data structures (Scherer, Lea and Scott
+    2006).
+
+    A synchronous queue has no capacity: enq waits for a deq to take its item
+    and deq waits for an enq to hand it one. In a dual structure a thread that
+    finds nobody to pair with does not poll - it links a node describing itself
+    (a reservation) and waits on that node only. A partner that arrives later
+    claims the node with one CAS, moves the item across and wakes the owner.
+    The structure therefore only ever holds nodes of a single mode: all data
+    (waiting enqs) or all requests (waiting deqs).
+
+    Two flavours, picked by the Fair parameter:
+
+    fair (transfer_queue): waiters form a Michael-Scott queue, so they are
+        served FIFO. A thread appends at the tail if the queue is empty or holds
+        its own mode, otherwise it claims head->next.
+
+    unfair (transfer_stack): waiters form a Treiber stack, served LIFO. A thread
+        that sees a complementary node on top pushes a "fulfilling" node over it,
+        claims the node below, then pops both. Anyone who finds a fulfilling node
+        on top helps it finish before doing its own work, so a stalled fulfiller
+        never blocks the stack. LIFO keeps the most recently parked (hottest)
+        thread busy and is usually the faster one.
+
+    Waiting is spin-then-park: a waiter at the front of the line spins for a
+    while (the hand-off is usually close), after which it blocks on a condition
+    variable embedded in its node. The waker publishes "done" and then checks
+    the node's parked flag - both seq_cst, the same Dekker pairing as the
+    coroutine waiter_list - and only takes the lock if the owner went to sleep.
+    The spin budget adapts: it follows a running average of how long successful
+    spins took and shrinks whenever spinning ended in a park anyway.
+
+    Timed waits cancel by CASing their node from waiting to cancelled. If that
+    loses, a partner has already claimed the node and we wait for it to finish
+    - the hand-off happened. A cancelled node stays linked until it reaches the
+    front, where whoever finds it (usually the canceller itself, or the waiter
+    ahead of it when that one leaves) unlinks it. So cancelled nodes never
+    outlive the live waiters queued ahead of them.
+
+    Nodes are reclaimed with hazard pointers. Each waiter keeps one on its own
+    node, so the node outlives every partner that still needs it.
+*/
+namespace detail
+{
+enum sync_state : int
+{
+    waiting,
+    claimed,    // a partner is moving the item across
+    done,
+    cancelled,  // timed out before anybody claimed it
+};
+
+// empty: wait forever
+using deadline = std::optional<std::chrono::steady_clock::time_point>;
+
+inline bool expired(const deadline& until)
+{
+    return until && *until <= std::chrono::steady_clock::now();
+}
+
+template<typename T>
+struct sync_node
+{
+    explicit sync_node(bool isData)
+        : isData(isData)
+    {}
+
+    std::optional<T> value;
+    bool isData;
+    bool fulfilling = false;
+    std::atomic<sync_node*> next{ nullptr };
+    std::atomic<int> state{ waiting };
+
+    std::atomic<bool> parked{ false };
+    std::mutex parkLock;
+    std::condition_variable parkCv;
+};
+
+/*
+    Adaptive spin budget, in the spirit of glibc's adaptive mutexes: spin for
+    up to twice the running average of spins that ended in a hand-off. Spins
+    that end in a park anyway pull the average down.
+*/
+struct adaptive_spin
+{
+    // single core: spinning only delays the partner we are waiting for
+    static inline const int max_spins = std::thread::hardware_concurrency() > 1 ? 4096 : 0;
+    static constexpr int min_spins = 16;
+
+    int limit() const
+    {
+        return std::min(max_spins, 2 * estimate_.load(std::memory_order_relaxed) + min_spins);
+    }
+
+    void record(int spun)
+    {
+        int e = estimate_.load(std::memory_order_relaxed);
+        estimate_.store(e + (spun - e) / 8, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<int> estimate_{ 64 };
+};
+
+/*
+    Returns false if the deadline passed and s was cancelled, true once a
+    partner has finished with s.
+*/
+template<typename Node, typename ShouldSpin>
+bool await_done(Node* s, ShouldSpin shouldSpin, adaptive_spin& spin, deadline until)
+{
+    const int limit = spin.limit();
+    for(int spun = 0; spun < limit; ++spun)
+    {
+        if(s->state.load(std::memory_order_acquire) == done)
+        {
+            spin.record(spun);
+            return true;
+        }
+        if(!shouldSpin())
+        {
+            break;
+        }
+    }
+    spin.record(0);
+
+    s->parked.store(true);
+    std::unique_lock<std::mutex> lk{s->parkLock};
+    while(s->state.load() != done)
+    {
+        if(!until)
+        {
+            s->parkCv.wait(lk);
+        }
+        else if(s->parkCv.wait_until(lk, *until) == std::cv_status::timeout)
+        {
+            int expected = waiting;
+            if(s->state.compare_exchange_strong(expected, cancelled))
+            {
+                return false;
+            }
+            // already claimed: the hand-off is under way, see it through
+            until.reset();
+        }
+    }
+    return true;
+}
+
+struct no_op
+{
+    void operator()() const {}
+};
+
+template<typename Node>
+void wake(Node* m)
+{
+    m->state.store(done);
+    if(m->parked.load())
+    {
+        std::lock_guard<std::mutex> lk{m->parkLock};
+        m->parkCv.notify_one();
+    }
+}
+
+// move the item between the caller and a claimed node of the other mode
+template<typename T>
+void hand_over(std::optional<T>& item, sync_node<T>* m)
+{
+    if(item.has_value())
+    {
+        m->value = std::move(item);
+        item.reset();
+    }
+    else
+    {
+        item = std::move(m->value);
+        m->value.reset();
+    }
+}
+
+/*
+    Hazard slots: 0 head, 1 tail, 2 our own node or head->next.
+*/
+template<typename T>
+struct transfer_queue
+{
+    using node = sync_node<T>;
+
+    transfer_queue()
+        : head_(new node{false}), tail_(head_.load())
+    {}
+
+    transfer_queue(const transfer_queue&) = delete;
+    transfer_queue& operator=(const transfer_queue&) = delete;
+
+    /*
+        An engaged item is an enq: on success it has been taken. An empty item
+        is a deq: on success it holds the value handed over. On failure (the
+        deadline passed) item is as it was. onPark runs once our node is
+        linked, before we wait on it.
+    */
+    template<typename OnPark = no_op>
+    bool transfer(std::optional<T>& item, const deadline& until, OnPark onPark = {})
+    {
+        const bool isData = item.has_value();
+        hazard::guard gHead{0}, gTail{1}, gNode{2};
+        node* s = nullptr;
+
+        while(true)
+        {
+            node* t = gTail.protect(tail_);
+            node* h = gHead.protect(head_);
+
+            if(h == t || t->isData == isData)
+            {
+                node* tn = t->next.load();
+                if(t != tail_.load())
+                {
+                    continue;
+                }
+                if(tn != nullptr)
+                {
+                    tail_.compare_exchange_strong(t, tn);
+                    continue;
+                }
+
+                if(expired(until))
+                {
+                    if(s != nullptr)
+                    {
+                        item = std::move(s->value);
+                        delete s;
+                    }
+                    return false;
+                }
+                if(s == nullptr)
+                {
+                    s = new node{isData};
+                    s->value = std::move(item);
+                    item.reset();
+                }
+                // slot 2 may have been lent to head->next on an earlier lap
+                gNode.set(s);
+                node* expected = nullptr;
+                if(!t->next.compare_exchange_strong(expected, s))
+                {
+                    continue;
+                }
+                // on failure the CAS would overwrite t, which we still need
+                node* expectedTail = t;
+                tail_.compare_exchange_strong(expectedTail, s);
+                onPark();
+
+                if(!await_done(s, [this, t](){ return head_.load() == t; }, spin_, until))
+                {
+                    if(isData)
+                    {
+                        item = std::move(s->value);
+                        s->value.reset();
+                    }
+                    gTail.clear();
+                    skip_cancelled(gHead, gTail);
+                    return false;
+                }
+
+                // normally the partner has already moved head past t
+                advance_head(t, s);
+                if(!isData)
+                {
+                    item = std::move(s->value);
+                    s->value.reset();
+                }
+                return true;
+            }
+
+            node* m = h->next.load();
+            gNode.set(m);
+            if(t != tail_.load() || m == nullptr || h != head_.load())
+            {
+                continue;
+            }
+
+            int expected = waiting;
+            if(!m->state.compare_exchange_strong(expected, claimed))
+            {
+                // somebody else got m first, or it was cancelled
+                advance_head(h, m);
+                continue;
+            }
+            advance_head(h, m);
+
+            if(s != nullptr)
+            {
+                // built a node on an earlier lap but never linked it
+                item = std::move(s->value);
+                delete s;
+            }
+            hand_over(item, m);
+            wake(m);
+            return true;
+        }
+    }
+
+    ~transfer_queue()
+    {
+        node* curr = head_.load();
+        while(curr)
+        {
+            node* next = curr->next.load();
+            delete curr;
+            curr = next;
+        }
+    }
+
+private:
+    void advance_head(node* h, node* nh)
+    {
+        if(head_.load() == h && head_.compare_exchange_strong(h, nh))
+        {
+            hazard::retire(h);
+        }
+    }
+
+    // unlink the cancelled nodes at the front
+    void skip_cancelled(hazard::guard& gHead, hazard::guard& gNext)
+    {
+        while(true)
+        {
+            node* h = gHead.protect(head_);
+            node* m = h->next.load();
+            gNext.set(m);
+            if(h != head_.load())
+            {
+                continue;
+            }
+            if(m == nullptr || m->state.load() != cancelled)
+            {
+                return;
+            }
+
+            // never let head pass a lagging tail
+            node* t = h;
+            if(tail_.compare_exchange_strong(t, m))
+            {
+                continue;
+            }
+            advance_head(h, m);
+        }
+    }
+
+    static constexpr size_t cacheLineSize = 64;
+
+    alignas(cacheLineSize) std::atomic<node*> head_;
+    alignas(cacheLineSize) std::atomic<node*> tail_;
+    adaptive_spin spin_;
+};
+
+/*
+    Hazard slots: 0 head, 1 the node under a fulfiller, 2 our own node.
+
+    A fulfilling node s and the waiter m it claimed may be popped by a helper,
+    but only the owner of s retires them, once it has finished with m. That is
+    what lets the owner keep using m after the pop.
+*/
+template<typename T>
+struct transfer_stack
+{
+    using node = sync_node<T>;
+
+    transfer_stack() = default;
+
+    transfer_stack(const transfer_stack&) = delete;
+    transfer_stack& operator=(const transfer_stack&) = delete;
+
+    template<typename OnPark = no_op>
+    bool transfer(std::optional<T>& item, const deadline& until, OnPark onPark = {})
+    {
+        const bool isData = item.has_value();
+        hazard::guard gHead{0}, gNext{1}, gNode{2};
+        node* s = nullptr;
+
+        while(true)
+        {
+            node* h = gHead.protect(head_);
+
+            if(h != nullptr && !h->fulfilling && h->state.load() == cancelled)
+            {
+                pop(h);
+                continue;
+            }
+
+            if(h == nullptr || (!h->fulfilling && h->isData == isData))
+            {
+                if(expired(until))
+                {
+                    if(s != nullptr)
+                    {
+                        if(s->value.has_value())
+                        {
+                            item = std::move(s->value);
+                        }
+                        delete s;
+                    }
+                    return false;
+                }
+                if(s == nullptr)
+                {
+                    s = new node{isData};
+                    gNode.set(s);
+                }
+                if(s->fulfilling)
+                {
+                    s->fulfilling = false;
+                }
+                if(isData && !s->value.has_value())
+                {
+                    s->value = std::move(item);
+                    item.reset();
+                }
+                s->next.store(h, std::memory_order_relaxed);
+                if(!head_.compare_exchange_strong(h, s))
+                {
+                    continue;
+                }
+                onPark();
+
+                bool handedOver = await_done(s, [this, s](){
+                    return head_.load() == s || s->state.load() == claimed;
+                }, spin_, until);
+
+                if(isData != handedOver)
+                {
+                    item = std::move(s->value);
+                    s->value.reset();
+                }
+                if(!handedOver)
+                {
+                    pop_cancelled(gHead);
+                }
+                return handedOver;
+            }
+
+            if(!h->fulfilling)
+            {
+                if(s == nullptr)
+                {
+                    s = new node{isData};
+                    gNode.set(s);
+                }
+                if(s->value.has_value())
+                {
+                    item = std::move(s->value);
+                    s->value.reset();
+                }
+                s->fulfilling = true;
+                s->next.store(h, std::memory_order_relaxed);
+                if(!head_.compare_exchange_strong(h, s))
+                {
+                    continue;
+                }
+
+                if(fulfil(s, item, gNext))
+                {
+                    return true;
+                }
+                // every waiter under us gave up: we have been popped
+                hazard::retire(s);
+                gNode.clear();
+                s = nullptr;
+                continue;
+            }
+
+            // help the fulfiller on top
+            node* m = h->next.load();
+            gNext.set(m);
+            if(head_.load() != h || h->next.load() != m)
+            {
+                continue;
+            }
+            if(m == nullptr)
+            {
+                head_.compare_exchange_strong(h, nullptr);
+                continue;
+            }
+            node* mn = m->next.load();
+            if(try_match(m))
+            {
+                head_.compare_exchange_strong(h, mn);
+            }
+            else if(h->next.compare_exchange_strong(m, mn))
+            {
+                hazard::retire(m);
+            }
+        }
+    }
+
+    ~transfer_stack()
+    {
+        node* curr = head_.load();
+        while(curr)
+        {
+            node* next = curr->next.load();
+            delete curr;
+            curr = next;
+        }
+    }
+
+private:
+    // h is a cancelled waiter we found on top
+    void pop(node* h)
+    {
+        node* next = h->next.load();
+        if(head_.compare_exchange_strong(h, next))
+        {
+            hazard::retire(h);
+        }
+    }
+
+    void pop_cancelled(hazard::guard& gHead)
+    {
+        while(true)
+        {
+            node* h = gHead.protect(head_);
+            if(h == nullptr || h->fulfilling || h->state.load() != cancelled)
+            {
+                return;
+            }
+            pop(h);
+        }
+    }
+
+    // m is matched to the fulfiller above it unless it was cancelled
+    static bool try_match(node* m)
+    {
+        int expected = waiting;
+        return m->state.compare_exchange_strong(expected, claimed) || expected != cancelled;
+    }
+
+    /*
+        s is on top: claim the waiter right below it, pop both and hand the
+        item over. Returns false if the waiters ran out first, in which case s
+        has been popped.
+    */
+    bool fulfil(node* s, std::optional<T>& item, hazard::guard& gNext)
+    {
+        while(true)
+        {
+            node* m = s->next.load();
+            if(m == nullptr)
+            {
+                node* expected = s;
+                head_.compare_exchange_strong(expected, nullptr);
+                return false;
+            }
+            gNext.set(m);
+            if(s->next.load() != m)
+            {
+                continue;
+            }
+
+            node* mn = m->next.load();
+            if(try_match(m))
+            {
+                // fails only if a helper already popped us
+                node* expected = s;
+                head_.compare_exchange_strong(expected, mn);
+                hand_over(item, m);
+                wake(m);
+                gNext.clear();
+                hazard::retire(m);
+                hazard::retire(s);
+                return true;
+            }
+            if(s->next.compare_exchange_strong(m, mn))
+            {
+                hazard::retire(m);
+            }
+        }
+    }
+
+    static constexpr size_t cacheLineSize = 64;
+
+    alignas(cacheLineSize) std::atomic<node*> head_{ nullptr };
+    adaptive_spin spin_;
+};
+} // namespace detail
+
+/*
+    enq hands its item straight to a deq, blocking until one takes it; deq
+    blocks until an enq hands it one. Any number of threads may wait on each
+    side. Fair serves waiters in arrival order, unfair (the default) most
+    recent first.
+
+    offer / poll give up after a timeout, try_offer / try_poll only succeed if
+    a partner is already waiting. An offer that fails leaves its item with the
+    caller: an rvalue passed in is not moved from.
+
+    The enq / deq overloads taking onPark call it once the caller has queued
+    up to wait for a partner (they are not called if a partner was already
+    there). Anything that must know when a thread starts waiting - channels
+    waking a select - hooks in here.
+*/
+template<typename T, bool Fair = false>
+struct SynchronousQueue
+{
+    void enq(T item)
+    {
+        std::optional<T> x{std::move(item)};
+        transferer_.transfer(x, std::nullopt);
+    }
+
+    T deq(void)
+    {
+        std::optional<T> x;
+        transferer_.transfer(x, std::nullopt);
+        return std::move(*x);
+    }
+
+    template<typename OnPark>
+    void enq(T item, OnPark onPark)
+    {
+        std::optional<T> x{std::move(item)};
+        transferer_.transfer(x, std::nullopt, std::move(onPark));
+    }
+
+    template<typename OnPark>
+    T deq(OnPark onPark)
+    {
+        std::optional<T> x;
+        transferer_.transfer(x, std::nullopt, std::move(onPark));
+        return std::move(*x);
+    }
+
+    template<typename Rep, typename Period>
+    bool offer(const T& item, std::chrono::duration<Rep, Period> timeout)
+    {
+        return offer_until(item, std::chrono::steady_clock::now() + timeout);
+    }
+    template<typename Rep, typename Period>
+    bool offer(T&& item, std::chrono::duration<Rep, Period> timeout)
+    {
+        return offer_until(std::move(item), std::chrono::steady_clock::now() + timeout);
+    }
+
+    bool try_offer(const T& item)
+    {
+        return offer_until(item, std::chrono::steady_clock::time_point{});
+    }
+    bool try_offer(T&& item)
+    {
+        return offer_until(std::move(item), std::chrono::steady_clock::time_point{});
+    }
+
+    template<typename Rep, typename Period>
+    std::optional<T> poll(std::chrono::duration<Rep, Period> timeout)
+    {
+        std::optional<T> x;
+        transferer_.transfer(x, std::chrono::steady_clock::now() + timeout);
+        return x;
+    }
+
+    std::optional<T> try_poll()
+    {
+        std::optional<T> x;
+        transferer_.transfer(x, std::chrono::steady_clock::time_point{});
+        return x;
+    }
+
+private:
+    template<typename U>
+    bool offer_until(U&& item, std::chrono::steady_clock::time_point until)
+    {
+        std::optional<T> x{std::forward<U>(item)};
+        if(transferer_.transfer(x, until))
+        {
+            return true;
+        }
+        if constexpr(!std::is_const_v<std::remove_reference_t<U>>)
+        {
+            item = std::move(*x);
+        }
+        return false;
+    }
+
+    std::conditional_t<Fair, detail::transfer_queue<T>, detail::transfer_stack<T>> transferer_;
+};
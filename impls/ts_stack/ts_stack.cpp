@@ -0,0 +1,133 @@
+#include "ts_stack.h"
+#include "../lock_free_stack/lock_free_stack.h"
+#include "../../exercises/chapter10/test_pool.h"
+#include <cassert>
+#include <chrono>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+void lifo_test()
+{
+    ts_stack<std::unique_ptr<int>> S(1, 16);
+    assert(!S.deq().has_value());
+    for(int i = 0; i < 16; ++i)
+    {
+        assert(S.enq(std::make_unique<int>(i)));
+    }
+    assert(!S.enq(std::make_unique<int>(16)));
+    for(int i = 15; i >= 8; --i)
+    {
+        assert(**S.deq() == i);
+    }
+    // the freed slots are reused
+    for(int i = 8; i < 16; ++i)
+    {
+        assert(S.enq(std::make_unique<int>(i)));
+    }
+    for(int i = 15; i >= 0; --i)
+    {
+        assert(**S.deq() == i);
+    }
+    assert(S.empty() && !S.deq().has_value());
+}
+
+/*
+    Pushes that finished one after another come out in reverse, whichever
+    pools they went into.
+*/
+void cross_pool_order_test()
+{
+    static constexpr int threads = 4;
+    static constexpr int per_thread = 1000;
+    ts_stack<int> S(threads, per_thread);
+
+    for(int t = 0; t < threads; ++t)
+    {
+        std::thread([&S, t](){
+            for(int i = 0; i < per_thread; ++i)
+            {
+                assert(S.enq(t * per_thread + i));
+            }
+        }).join();
+    }
+    for(int x = threads * per_thread - 1; x >= 0; --x)
+    {
+        assert(S.deq() == x);
+    }
+    assert(!S.deq().has_value());
+}
+
+/*
+    ns per operation with every thread running the same mix: pushes out of
+    every push_every ops, pops the rest. Empty pops count as operations.
+*/
+template<typename Stack>
+long long ns_per_op(size_t threads, size_t push_every, size_t pushes_of)
+{
+    static constexpr size_t total = 1 << 17;
+    const size_t per_thread = total / threads;
+
+    std::unique_ptr<Stack> S;
+    if constexpr(std::is_same_v<Stack, ts_stack<int>>)
+    {
+        S = std::make_unique<Stack>(threads, per_thread);
+    }
+    else
+    {
+        S = std::make_unique<Stack>();
+    }
+    std::vector<std::thread> workers;
+
+    auto start_time = std::chrono::steady_clock::now();
+    for(size_t t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&S, per_thread, push_every, pushes_of](){
+            for(size_t i = 0; i < per_thread; ++i)
+            {
+                if(i % push_every < pushes_of)
+                {
+                    S->enq(static_cast<int>(i));
+                }
+                else
+                {
+                    S->deq();
+                }
+            }
+        });
+    }
+    for(auto& th : workers)
+    {
+        th.join();
+    }
+    auto total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_time);
+
+    return (total_time / total).count();
+}
+
+void benchmark()
+{
+    for(size_t threads = 1; threads <= 16; threads *= 2)
+    {
+        std::cout << std::format("{} threads: push heavy (3:1) ts stack {}ns/op, treiber+elimination {}ns/op; "
+                "mixed (1:1) ts stack {}ns/op, treiber+elimination {}ns/op\n",
+                threads,
+                ns_per_op<ts_stack<int>>(threads, 4, 3),
+                ns_per_op<lock_free_stack<int>>(threads, 4, 3),
+                ns_per_op<ts_stack<int>>(threads, 2, 1),
+                ns_per_op<lock_free_stack<int>>(threads, 2, 1));
+    }
+}
+
+int main()
+{
+    ts_stack<int> S(64, 10000);
+    test_pool(S);
+    lifo_test();
+    cross_pool_order_test();
+
+    benchmark();
+}
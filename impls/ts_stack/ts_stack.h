@@ -0,0 +1,262 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+/*
+    Timestamped stack (Dodds, Haas and Kirsch 2015).
+
+    There is no head. Every thread pushes into its own single producer pool
+    and stamps the element with a timestamp; pop scans all the pools for the
+    youngest element and removes it with one CAS. Pushes from different
+    threads therefore never touch the same memory, and pops only collide when
+    they go for the same element.
+
+    Timestamps come from one atomic counter (the paper's TS-atomic). A pushed
+    element is visible before it is stamped; until then it counts as younger
+    than everything.
+
+    pop records the clock when it starts. An element stamped after that (or not
+    stamped yet) was pushed while we were popping, so we may take it on the
+    spot - the push and the pop cancel out, which is the TS stack's built-in
+    elimination. Otherwise we take the youngest element we saw; a lost CAS
+    means somebody else took it, and we rescan. We only report empty if a scan
+    found nothing and no pool has been pushed to since we looked at it.
+
+    A pool is an array owned by its thread:
+
+        [ 0 .. top ) slots, oldest at the bottom
+
+    Each slot has a state word, [ version | free / claimed / done ]. A pop
+    claims a slot by CASing it from free to claimed at the version it saw,
+    moves the value out and marks it done. Only the owner reuses slots: before
+    each push it lowers top past done slots and bumps the version, so a pop
+    still holding the old version cannot claim the new element by mistake.
+    Pops take the youngest free slot of a pool, so done slots collect at the
+    top and the pool stays compact.
+
+    Every thread that pushes takes one of max_threads pools for good, and each
+    holds up to per_thread elements; enq returns false when the caller's pool
+    is full.
+*/
+template<typename T>
+struct ts_stack
+{
+    ts_stack(size_t max_threads, size_t per_thread)
+        : pools_(max_threads)
+    {
+        for(auto& p : pools_)
+        {
+            p = std::make_unique<pool>(per_thread);
+        }
+    }
+
+    ts_stack(const ts_stack&) = delete;
+    ts_stack& operator=(const ts_stack&) = delete;
+
+    template<typename ... Args>
+    bool enq(Args&&... args)
+    {
+        pool& p = my_pool();
+        size_t top = p.top.load(std::memory_order_relaxed);
+        while(top > 0 && state_of(p.slots[top - 1].state.load(std::memory_order_acquire)) == done)
+        {
+            --top;
+        }
+        p.top.store(top, std::memory_order_release);
+        if(top == p.slots.size())
+        {
+            return false;
+        }
+
+        slot& s = p.slots[top];
+        const uint64_t version = version_of(s.state.load(std::memory_order_relaxed)) + 1;
+        s.ts.store(unstamped, std::memory_order_relaxed);
+        s.value.emplace(std::forward<Args>(args)...);
+        s.state.store(pack(version, free), std::memory_order_release);
+        p.pushes.store(p.pushes.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        p.top.store(top + 1, std::memory_order_release);
+
+        s.ts.store(clock_.fetch_add(1), std::memory_order_release);
+        return true;
+    }
+
+    std::optional<T> deq()
+    {
+        const uint64_t start = clock_.load();
+
+        while(true)
+        {
+            const size_t n = registered();
+            const size_t first = first_pool(n);
+            candidate best;
+            // push counts only grow, so an unchanged sum means no pool changed
+            uint64_t pushes = 0;
+
+            for(size_t j = 0; j < n; ++j)
+            {
+                pool& p = *pools_[(first + j) % n];
+                pushes += p.pushes.load(std::memory_order_acquire);
+                candidate c = youngest(p);
+                if(c.s == nullptr)
+                {
+                    continue;
+                }
+                if(c.ts == unstamped || c.ts >= start)
+                {
+                    // pushed since we started: eliminate
+                    best = c;
+                    break;
+                }
+                if(best.s == nullptr || c.ts > best.ts)
+                {
+                    best = c;
+                }
+            }
+
+            if(best.s != nullptr)
+            {
+                if(auto res = take(best))
+                {
+                    return res;
+                }
+                continue;
+            }
+
+            uint64_t now = 0;
+            for(size_t i = 0; i < n; ++i)
+            {
+                now += pools_[i]->pushes.load(std::memory_order_acquire);
+            }
+            if(now == pushes && registered() == n)
+            {
+                return std::nullopt;
+            }
+        }
+    }
+
+    // no element anywhere, at some point during the call
+    bool empty() const
+    {
+        for(size_t i = 0, n = registered(); i < n; ++i)
+        {
+            pool& p = *pools_[i];
+            for(size_t k = p.top.load(std::memory_order_acquire); k > 0; --k)
+            {
+                if(state_of(p.slots[k - 1].state.load(std::memory_order_acquire)) != done)
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+private:
+    static constexpr uint64_t unstamped = UINT64_MAX;
+    static constexpr uint64_t free = 0, claimed = 1, done = 2;
+    static constexpr size_t cacheLineSize = 64;
+
+    static uint64_t pack(uint64_t version, uint64_t state)
+    {
+        return version << 2 | state;
+    }
+    static uint64_t version_of(uint64_t word)
+    {
+        return word >> 2;
+    }
+    static uint64_t state_of(uint64_t word)
+    {
+        return word & 3;
+    }
+
+    struct slot
+    {
+        std::atomic<uint64_t> state{ pack(0, done) };
+        std::atomic<uint64_t> ts{ unstamped };
+        std::optional<T> value;
+    };
+
+    struct alignas(cacheLineSize) pool
+    {
+        explicit pool(size_t capacity)
+            : slots(capacity)
+        {}
+
+        std::vector<slot> slots;
+        std::atomic<size_t> top{ 0 };
+        std::atomic<uint64_t> pushes{ 0 };
+    };
+
+    struct candidate
+    {
+        slot* s = nullptr;
+        uint64_t state = 0;
+        uint64_t ts = 0;
+    };
+
+    // the youngest free slot of p, if any
+    static candidate youngest(pool& p)
+    {
+        for(size_t k = p.top.load(std::memory_order_acquire); k > 0; --k)
+        {
+            slot& s = p.slots[k - 1];
+            uint64_t state = s.state.load(std::memory_order_acquire);
+            if(state_of(state) == free)
+            {
+                return { &s, state, s.ts.load(std::memory_order_acquire) };
+            }
+        }
+        return {};
+    }
+
+    static std::optional<T> take(candidate c)
+    {
+        uint64_t expected = c.state;
+        if(!c.s->state.compare_exchange_strong(expected, pack(version_of(c.state), claimed)))
+        {
+            return std::nullopt;
+        }
+        std::optional<T> res = std::move(c.s->value);
+        c.s->value.reset();
+        c.s->state.store(pack(version_of(c.state), done), std::memory_order_release);
+        return res;
+    }
+
+    size_t registered() const
+    {
+        return std::min(registered_.load(std::memory_order_acquire), pools_.size());
+    }
+
+    // spread the scans out so that pops do not all start on the same pool
+    size_t first_pool(size_t n) const
+    {
+        static thread_local size_t rotation = 0;
+        return n == 0 ? 0 : rotation++ % n;
+    }
+
+    pool& my_pool()
+    {
+        static thread_local std::unordered_map<uint64_t, pool*> mine;
+        auto it = mine.find(id_);
+        if(it != mine.end())
+        {
+            return *it->second;
+        }
+        size_t i = registered_.fetch_add(1);
+        assert(i < pools_.size() && "more pushing threads than pools");
+        return *mine.emplace(id_, pools_[i].get()).first->second;
+    }
+
+    static inline std::atomic<uint64_t> next_id_{ 0 };
+
+    const uint64_t id_ = next_id_.fetch_add(1);
+    std::vector<std::unique_ptr<pool>> pools_;
+    std::atomic<size_t> registered_{ 0 };
+    alignas(cacheLineSize) std::atomic<uint64_t> clock_{ 0 };
+};
@@ -0,0 +1,205 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+/*
+    Per-thread node cache with batched hand-off (Bonwick's magazines).
+
+    Every thread keeps two magazines (fixed arrays of free blocks). Allocation
+    and deallocation only touch the calling thread's magazines. When both are
+    empty (or both full) the thread swaps a whole magazine with the global
+    depot under one lock, so a producer thread that only allocates and a
+    consumer thread that only frees meet in the depot magazine_size blocks at a
+    time. Once the depot holds enough magazines nothing calls malloc again.
+
+    There is one pool per block size and alignment, shared by every queue
+    with that node type. Blocks go back to the system only at exit; a thread's
+    magazines go back to the depot when the thread exits.
+
+    magazine_allocator is the std allocator interface on top, so it can be
+    dropped in wherever std::allocator<Node> was used.
+*/
+template<size_t Size, size_t Align>
+struct magazine_pool
+{
+    static constexpr size_t magazine_size = 64;
+
+    struct magazine
+    {
+        size_t count = 0;
+        std::array<void*, magazine_size> blocks;
+
+        bool empty() const { return count == 0; }
+        bool full() const { return count == magazine_size; }
+    };
+
+    static magazine_pool& instance()
+    {
+        static magazine_pool pool;
+        return pool;
+    }
+
+    void* allocate()
+    {
+        cache& c = thread_cache();
+
+        if(c.loaded->empty())
+        {
+            if(!c.previous->empty())
+            {
+                std::swap(c.loaded, c.previous);
+            }
+            else if(!swap_for_full(c.loaded))
+            {
+                fresh_.fetch_add(1, std::memory_order_relaxed);
+                return ::operator new(Size, std::align_val_t{Align});
+            }
+        }
+        return c.loaded->blocks[--c.loaded->count];
+    }
+
+    void deallocate(void* p)
+    {
+        cache& c = thread_cache();
+
+        if(c.loaded->full())
+        {
+            if(!c.previous->full())
+            {
+                std::swap(c.loaded, c.previous);
+            }
+            else
+            {
+                swap_for_empty(c.previous);
+                std::swap(c.loaded, c.previous);
+            }
+        }
+        c.loaded->blocks[c.loaded->count++] = p;
+    }
+
+    // blocks that had to come from operator new (rather than a magazine)
+    size_t fresh_allocations() const
+    {
+        return fresh_.load(std::memory_order_relaxed);
+    }
+
+    ~magazine_pool()
+    {
+        for(magazine* m : full_)
+        {
+            release(m);
+        }
+        for(magazine* m : empty_)
+        {
+            delete m;
+        }
+    }
+
+private:
+    struct cache
+    {
+        cache()
+            : loaded(new magazine), previous(new magazine)
+        {}
+        ~cache()
+        {
+            instance().take_back(loaded);
+            instance().take_back(previous);
+        }
+        magazine* loaded;
+        magazine* previous;
+    };
+
+    // only called through instance(), so the pool outlives every cache
+    static cache& thread_cache()
+    {
+        thread_local cache c;
+        return c;
+    }
+
+    // hand in an empty magazine, get a full one back
+    bool swap_for_full(magazine*& m)
+    {
+        std::unique_lock<std::mutex> lk{depotLock_};
+        if(full_.empty())
+        {
+            return false;
+        }
+        empty_.push_back(m);
+        m = full_.back();
+        full_.pop_back();
+        return true;
+    }
+
+    // hand in a full magazine, get an empty one back
+    void swap_for_empty(magazine*& m)
+    {
+        std::unique_lock<std::mutex> lk{depotLock_};
+        full_.push_back(m);
+        if(empty_.empty())
+        {
+            lk.unlock();
+            m = new magazine;
+            return;
+        }
+        m = empty_.back();
+        empty_.pop_back();
+    }
+
+    void take_back(magazine* m)
+    {
+        std::unique_lock<std::mutex> lk{depotLock_};
+        (m->empty() ? empty_ : full_).push_back(m);
+    }
+
+    void release(magazine* m)
+    {
+        for(size_t i = 0; i < m->count; ++i)
+        {
+            ::operator delete(m->blocks[i], std::align_val_t{Align});
+        }
+        delete m;
+    }
+
+    std::mutex depotLock_;
+    std::vector<magazine*> full_;
+    std::vector<magazine*> empty_;
+    std::atomic<size_t> fresh_{ 0 };
+};
+
+template<typename T>
+struct magazine_allocator
+{
+    using value_type = T;
+    using pool = magazine_pool<sizeof(T), alignof(T)>;
+
+    magazine_allocator() = default;
+    template<typename U>
+    magazine_allocator(const magazine_allocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        if(n == 1)
+        {
+            return static_cast<T*>(pool::instance().allocate());
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{alignof(T)}));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if(n == 1)
+        {
+            pool::instance().deallocate(p);
+            return;
+        }
+        ::operator delete(p, std::align_val_t{alignof(T)});
+    }
+
+    template<typename U>
+    bool operator==(const magazine_allocator<U>&) const { return true; }
+};
@@ -0,0 +1,309 @@
+#pragma once
+#include <atomic>
+#include <iterator>
+#include <optional>
+#include <utility>
+#include "../hazard_pointer/hazard_pointer.h"
+
+/*
+    Lock-free unbounded queue (Michael and Scott 1996).
+
+    Like the two lock queue there is always a dummy node at head_, but both
+    ends are moved with CAS:
+
+    enq: link the new node after the last node with a CAS on last->next, then
+         try to swing tail_ to it. If that second CAS fails somebody already
+         helped: any thread that finds tail_ lagging (tail_->next != nullptr)
+         moves it forward before doing anything else.
+
+    deq: CAS head_ from the dummy to its successor, which becomes the new dummy,
+         and take the value out of it.
+
+    Reclamation uses hazard pointers: slot 0 protects head_ / tail_, slot 1
+    protects head_->next (whose value we are about to take). A node is retired
+    once it has been swung past as a dummy, so no thread can reach it through
+    head_ any more, and it is only freed when no hazard slot names it - this is
+    also what rules out ABA on head_ / tail_.
+
+    enq_range links a private chain and attaches it with the same single CAS on
+    last->next, then swings tail_ straight to the chain's last node, so tail_
+    lags by at most one link, as after a single enq. Only when a helper wins
+    that second CAS (helpers move tail_ one node at a time) is the rest of
+    the chain walked by later enq / deq calls.
+
+    deq_all makes tail_ exact, then CASes head_ straight from the dummy to the
+    last node, which becomes the new dummy (its value is moved out, as deq
+    does for a single node). Everything in between is ours: the chain walks it
+    and retires the nodes when it is destroyed.
+*/
+template<typename T>
+struct MSQueue
+{
+private:
+    struct node;
+
+public:
+    /*
+        A detached run of values in queue order. The nodes are retired, not
+        freed, when the chain dies: other threads may still hold hazard
+        pointers on them from before the detach.
+    */
+    struct chain
+    {
+        struct iterator
+        {
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = T;
+            using difference_type = std::ptrdiff_t;
+            using pointer = T*;
+            using reference = T&;
+
+            T& operator*() const
+            {
+                return curr == owner->last_ ? *owner->lastValue_ : *curr->value;
+            }
+            T* operator->() const
+            {
+                return &**this;
+            }
+            iterator& operator++()
+            {
+                curr = curr == owner->last_ ? nullptr : curr->next.load(std::memory_order_relaxed);
+                return *this;
+            }
+            iterator operator++(int)
+            {
+                iterator res = *this;
+                ++*this;
+                return res;
+            }
+            bool operator==(const iterator& rhs) const
+            {
+                return curr == rhs.curr;
+            }
+
+            chain* owner;
+            node* curr;
+        };
+
+        chain() = default;
+        // the values are in dummy->next ... last, but last stays in the queue
+        chain(node* dummy, node* last, std::optional<T> lastValue)
+            : dummy_(dummy), last_(last), lastValue_(std::move(lastValue))
+        {}
+        chain(chain&& other) noexcept
+            : dummy_(std::exchange(other.dummy_, nullptr)),
+            last_(std::exchange(other.last_, nullptr)),
+            lastValue_(std::move(other.lastValue_))
+        {}
+        chain(const chain&) = delete;
+
+        iterator begin()
+        {
+            return {this, dummy_ ? dummy_->next.load(std::memory_order_relaxed) : nullptr};
+        }
+        iterator end()
+        {
+            return {this, nullptr};
+        }
+        bool empty() const
+        {
+            return dummy_ == nullptr;
+        }
+
+        ~chain()
+        {
+            node* curr = dummy_;
+            while(curr && curr != last_)
+            {
+                node* next = curr->next.load(std::memory_order_relaxed);
+                hazard::retire(curr);
+                curr = next;
+            }
+        }
+
+    private:
+        node* dummy_ = nullptr;
+        node* last_ = nullptr;
+        std::optional<T> lastValue_;
+    };
+
+    MSQueue()
+        : head_(new node{}), tail_(head_.load())
+    {}
+
+    MSQueue(const MSQueue&) = delete;
+    MSQueue& operator=(const MSQueue&) = delete;
+
+    template<typename ... Args>
+    bool enq(Args&&... args)
+    {
+        node* n = new node{std::forward<Args>(args)...};
+        link(n, n);
+        return true;
+    }
+
+    template<typename It>
+    void enq_range(It first, It last)
+    {
+        if(first == last)
+        {
+            return;
+        }
+
+        node* chainHead = new node{*first};
+        node* chainTail = chainHead;
+        for(++first; first != last; ++first)
+        {
+            node* n = new node{*first};
+            chainTail->next.store(n, std::memory_order_relaxed);
+            chainTail = n;
+        }
+
+        link(chainHead, chainTail);
+    }
+
+    std::optional<T> deq()
+    {
+        hazard::guard gFirst{0}, gNext{1};
+
+        while(true)
+        {
+            node* first = gFirst.protect(head_);
+            node* last = tail_.load();
+            node* next = first->next.load();
+            gNext.set(next);
+
+            // first still being head_ means next has not been retired yet,
+            // so the hazard pointer on it was published in time
+            if(first != head_.load())
+            {
+                continue;
+            }
+
+            if(next == nullptr)
+            {
+                return std::nullopt;
+            }
+
+            if(first == last)
+            {
+                tail_.compare_exchange_strong(last, next);
+                continue;
+            }
+
+            if(head_.compare_exchange_strong(first, next))
+            {
+                // next is the new dummy: nobody else reads its value
+                std::optional<T> res{std::move(next->value)};
+                next->value.reset();
+                gFirst.clear();
+                hazard::retire(first);
+                return res;
+            }
+        }
+    }
+
+    chain deq_all()
+    {
+        hazard::guard gFirst{0}, gLast{1};
+
+        while(true)
+        {
+            node* first = gFirst.protect(head_);
+            node* last = gLast.protect(tail_);
+
+            if(first != head_.load())
+            {
+                continue;
+            }
+
+            node* next = last->next.load();
+            if(next != nullptr)
+            {
+                tail_.compare_exchange_strong(last, next);
+                continue;
+            }
+
+            if(first == last)
+            {
+                return {};
+            }
+
+            if(head_.compare_exchange_strong(first, last))
+            {
+                chain res{first, last, std::move(last->value)};
+                last->value.reset();
+                return res;
+            }
+        }
+    }
+
+    bool empty() const
+    {
+        hazard::guard g{0};
+        node* first = g.protect(head_);
+        return first->next.load() == nullptr;
+    }
+
+    ~MSQueue()
+    {
+        node* curr = head_.load();
+        while(curr)
+        {
+            node* next = curr->next.load();
+            delete curr;
+            curr = next;
+        }
+    }
+
+private:
+    struct node
+    {
+        node() = default;
+
+        template<typename ... Args>
+        explicit node(Args&&... args)
+            : value(std::in_place, std::forward<Args>(args)...)
+        {}
+
+        std::optional<T> value;
+        std::atomic<node*> next{ nullptr };
+    };
+
+    // attach an already linked run of nodes after the current last node
+    void link(node* chainHead, node* chainTail)
+    {
+        hazard::guard g{0};
+
+        while(true)
+        {
+            node* last = g.protect(tail_);
+            node* next = last->next.load();
+
+            if(last != tail_.load())
+            {
+                continue;
+            }
+
+            if(next == nullptr)
+            {
+                if(last->next.compare_exchange_weak(next, chainHead))
+                {
+                    tail_.compare_exchange_strong(last, chainTail);
+                    return;
+                }
+            }
+            else
+            {
+                // tail_ is lagging behind: help it along
+                tail_.compare_exchange_strong(last, next);
+            }
+        }
+    }
+
+    static constexpr size_t cacheLineSize = 64;
+
+    alignas(cacheLineSize) std::atomic<node*> head_;
+    alignas(cacheLineSize) std::atomic<node*> tail_;
+};
@@ -1,89 +1,270 @@
-#include <memory>
-#include <iostream>
-#include <cassert>
-#include <optional>
+#include "unbounded_queue.h"
+#include "ms_queue.h"
+#include "../../exercises/chapter10/test_pool.h"
+#include <chrono>
+#include <format>
+#include <thread>
+#include <vector>
 
-template<typename T>
-struct Node
+template<typename Queue>
+void single_threaded_test(Queue& Q)
 {
-    Node(T value, Node<T>* next = nullptr)
-        : value{value}, next{next}
-    {}
-    T value;
-    std::atomic<Node<T>*> next;
-};
-
-template<typename T>
-struct MRMWQueue
+    Q.enq(5);
+    assert(*Q.deq() == 5);
+
+    Q.enq(6);
+    Q.enq(9);
+
+    assert(*Q.deq() == 6);
+    assert(*Q.deq() == 9);
+    assert(!Q.deq().has_value());
+
+    Q.enq(6);
+    Q.enq(6);
+    Q.enq(6);
+    Q.enq(6);
+    Q.enq(6);
+    Q.enq(6);
+}
+
+template<typename Queue>
+void batch_test(Queue& Q)
 {
-    MRMWQueue(T init = T{})
-        : tail{new Node<T>{init}},
-        head{tail},
-        deqLock{},
-        enqLock{}
-    {}
-    void enq(T value)
+    assert(Q.deq_all().empty());
+
+    std::vector<int> batch{1, 2, 3, 4, 5};
+    Q.enq_range(batch.begin(), batch.begin());
+    assert(!Q.deq().has_value());
+
+    Q.enq(0);
+    Q.enq_range(batch.begin(), batch.end());
+    Q.enq(6);
+    assert(*Q.deq() == 0);
+
+    std::vector<int> drained;
     {
-        std::unique_lock<std::mutex> lk{enqLock};
+        auto all = Q.deq_all();
+        drained.assign(all.begin(), all.end());
+    }
+    assert((drained == std::vector<int>{1, 2, 3, 4, 5, 6}));
+    assert(!Q.deq().has_value());
+    assert(Q.deq_all().empty());
 
-        auto node = new Node<T>{value};
-        tail->next.store(node);
-        tail = node;
+    // the queue keeps working after being drained
+    Q.enq_range(batch.begin(), batch.begin() + 2);
+    assert(*Q.deq() == 1);
+    assert(*Q.deq() == 2);
+    assert(!Q.deq().has_value());
+}
+
+/*
+    Producers push batches while consumers mix deq and deq_all: every item
+    comes out exactly once, and each producer's items in the order they went in.
+*/
+template<typename Queue>
+void concurrent_batch_test()
+{
+    static constexpr int batches = 2000;
+    static constexpr int batch_size = 8;
+    static constexpr int per_producer = batches * batch_size;
 
+    Queue Q;
+    producer_consumer_test(4, 4, per_producer,
+        [&Q](int p){
+            std::vector<int> batch(batch_size);
+            for(int b = 0; b < batches; ++b)
+            {
+                for(int i = 0; i < batch_size; ++i)
+                {
+                    batch[i] = p * per_producer + b * batch_size + i;
+                }
+                Q.enq_range(batch.begin(), batch.end());
+            }
+        },
+        [&Q](int c, std::vector<int>& out){
+            if(c % 2 == 0)
+            {
+                auto all = Q.deq_all();
+                out.insert(out.end(), all.begin(), all.end());
+            }
+            else if(auto x = Q.deq())
+            {
+                out.push_back(*x);
+            }
+        },
+        drain_mode::until_all_out, true);
+    assert(!Q.deq().has_value());
+}
+
+/*
+    Every thread alternates enq and deq, so the queue stays short and both
+    ends are contended all the time.
+*/
+template<typename Queue>
+long long ns_per_op(size_t num_threads)
+{
+    static constexpr size_t total_ops = 1 << 20;
+    Queue Q;
+    std::vector<std::thread> threads;
+    const size_t pairs = total_ops / 2 / num_threads;
+
+    auto start_time = std::chrono::steady_clock::now();
+    for(size_t t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back([&Q, pairs](){
+            for(size_t i = 0; i < pairs; ++i)
+            {
+                Q.enq(static_cast<int>(i));
+                while(!Q.deq().has_value());
+            }
+        });
     }
-    std::optional<T> deq()
+    for(auto& th : threads)
     {
-        std::unique_lock<std::mutex> lk{deqLock};
+        th.join();
+    }
+    auto total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_time);
+
+    return (total_time / (pairs * 2 * num_threads)).count();
+}
 
-        auto result_node = head->next.load();
-        
-        if(result_node == nullptr)
+void benchmark()
+{
+    for(size_t num_threads = 1; num_threads <= 64; num_threads *= 2)
+    {
+        std::cout << std::format("{} threads: two lock {}ns/op, two lock + magazines {}ns/op, michael-scott {}ns/op\n",
+                num_threads,
+                ns_per_op<MRMWQueue<int, std::allocator<Node<int>>>>(num_threads),
+                ns_per_op<MRMWQueue<int>>(num_threads),
+                ns_per_op<MSQueue<int>>(num_threads));
+    }
+}
+
+/*
+    One producer, one consumer, moving batches either one item at a time or
+    with enq_range / deq_all.
+*/
+template<typename Queue>
+long long ns_per_item(size_t batch_size, bool batched)
+{
+    static constexpr size_t total_items = 1 << 20;
+    const size_t batches = total_items / batch_size;
+    Queue Q;
+    std::vector<int> batch(batch_size);
+
+    auto start_time = std::chrono::steady_clock::now();
+    std::thread producer([&](){
+        for(size_t b = 0; b < batches; ++b)
         {
-            return std::nullopt;
+            if(batched)
+            {
+                Q.enq_range(batch.begin(), batch.end());
+                continue;
+            }
+            for(int x : batch)
+            {
+                Q.enq(x);
+            }
         }
+    });
+    std::thread consumer([&](){
+        size_t received = 0;
+        while(received < batches * batch_size)
+        {
+            if(batched)
+            {
+                auto all = Q.deq_all();
+                received += std::distance(all.begin(), all.end());
+            }
+            else if(Q.deq().has_value())
+            {
+                ++received;
+            }
+        }
+    });
+    producer.join();
+    consumer.join();
+    auto total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_time);
 
-        T res = result_node->value;
+    return (total_time / (batches * batch_size)).count();
+}
 
-        auto to_free = head;
-        head = result_node;
-        delete to_free;
-        
-        return res;
+void batch_benchmark()
+{
+    for(size_t batch_size : {1, 8, 64})
+    {
+        std::cout << std::format("batch of {}: two lock {}ns/item single, {}ns/item batched; michael-scott {}ns/item single, {}ns/item batched\n",
+                batch_size,
+                ns_per_item<MRMWQueue<int>>(batch_size, false),
+                ns_per_item<MRMWQueue<int>>(batch_size, true),
+                ns_per_item<MSQueue<int>>(batch_size, false),
+                ns_per_item<MSQueue<int>>(batch_size, true));
     }
-    ~MRMWQueue()
+}
+
+/*
+    One thread only enqueues, another only dequeues: once the depot has warmed
+    up, nodes freed by the consumer flow back to the producer a magazine at a
+    time and nothing more comes from operator new.
+*/
+void steady_state_test()
+{
+    using pool = magazine_allocator<Node<int>>::pool;
+    MRMWQueue<int> Q;
+
+    auto run = [&Q](size_t items){
+        std::thread producer([&Q, items](){
+            for(size_t i = 0; i < items; ++i)
+            {
+                Q.enq(static_cast<int>(i));
+            }
+        });
+        std::thread consumer([&Q, items](){
+            for(size_t i = 0; i < items; ++i)
+            {
+                while(!Q.deq().has_value());
+            }
+        });
+        producer.join();
+        consumer.join();
+    };
+
+    // warm-up: the worst possible backlog, freed by a thread whose magazines
+    // all end up in the depot when it exits
+    static constexpr size_t items = 100000;
+    for(size_t i = 0; i < items; ++i)
     {
-        auto curr = head;
-        while(curr)
-        {
-            auto next_curr = curr->next.load();
-            delete curr;
-            curr = next_curr;
-        }
+        Q.enq(static_cast<int>(i));
     }
-private:
-    Node<T>* tail;
-    Node<T>* head;
-    std::mutex deqLock;
-    std::mutex enqLock;
-};
+    std::thread([&Q](){ while(Q.deq().has_value()); }).join();
+
+    size_t fresh = pool::instance().fresh_allocations();
+    run(items);
+    run(items);
+    assert(pool::instance().fresh_allocations() == fresh);
+}
 
 int main()
 {
-    MRMWQueue<int> Q;
-    Q.enq(5);
-    assert(*Q.deq() == 5);
+    MRMWQueue<int> twoLock;
+    single_threaded_test(twoLock);
 
-    Q.enq(6);
-    Q.enq(9);
+    MSQueue<int> ms;
+    single_threaded_test(ms);
 
-    assert(*Q.deq() == 6);
-    assert(*Q.deq() == 9);
-    assert(!Q.deq().has_value());
+    MSQueue<int> pool;
+    test_pool(pool);
 
-    Q.enq(6);
-    Q.enq(6);
-    Q.enq(6);
-    Q.enq(6);
-    Q.enq(6);
-    Q.enq(6);
+    MRMWQueue<int> twoLockBatch;
+    batch_test(twoLockBatch);
+    MSQueue<int> msBatch;
+    batch_test(msBatch);
+    concurrent_batch_test<MRMWQueue<int>>();
+    concurrent_batch_test<MSQueue<int>>();
+
+    steady_state_test();
+    benchmark();
+    batch_benchmark();
 }
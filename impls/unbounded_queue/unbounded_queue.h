@@ -0,0 +1,215 @@
+#pragma once
+#include <memory>
+#include <iostream>
+#include <cassert>
+#include <optional>
+#include <atomic>
+#include <iterator>
+#include <mutex>
+#include <utility>
+#include "magazine_allocator.h"
+
+/*
+    Two lock unbounded queue: one lock for each end, and a dummy node at the
+    head so that enq and deq never touch the same node when non-empty.
+
+    Nodes come from a per-thread magazine cache by default, allocated before
+    taking enqLock and freed after releasing deqLock, so neither lock is held
+    across a trip into the allocator.
+
+    enq_range links its nodes into a private chain first and splices the chain
+    on with one acquisition of enqLock. deq_all takes both locks (deqLock
+    first, as nothing else holds both) and detaches every node after the dummy
+    in O(1), handing them back as a chain that frees them when it goes away.
+*/
+
+template<typename T>
+struct Node
+{
+    Node(T value, Node<T>* next = nullptr)
+        : value{value}, next{next}
+    {}
+    T value;
+    std::atomic<Node<T>*> next;
+};
+
+template<
+    typename T,
+    typename Allocator = magazine_allocator<Node<T>>>
+struct MRMWQueue
+{
+    MRMWQueue(T init = T{}, const Allocator& allocator = Allocator{})
+        : alloc{allocator},
+        tail{make_node(init)},
+        head{tail},
+        deqLock{},
+        enqLock{}
+    {}
+    /*
+        Owns a detached run of nodes. Iterating yields the values in queue order.
+        Must not outlive the queue (its nodes go back through the queue's allocator).
+    */
+    struct chain
+    {
+        struct iterator
+        {
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = T;
+            using difference_type = std::ptrdiff_t;
+            using pointer = T*;
+            using reference = T&;
+
+            T& operator*() const { return node->value; }
+            T* operator->() const { return &node->value; }
+            iterator& operator++()
+            {
+                node = node->next.load(std::memory_order_relaxed);
+                return *this;
+            }
+            iterator operator++(int)
+            {
+                iterator res = *this;
+                ++*this;
+                return res;
+            }
+            bool operator==(const iterator&) const = default;
+
+            Node<T>* node;
+        };
+
+        chain(MRMWQueue* owner = nullptr, Node<T>* first = nullptr)
+            : owner_(owner), first_(first)
+        {}
+        chain(chain&& other) noexcept
+            : owner_(other.owner_),
+            first_(std::exchange(other.first_, nullptr))
+        {}
+        chain(const chain&) = delete;
+
+        iterator begin() const { return {first_}; }
+        iterator end() const { return {nullptr}; }
+        bool empty() const { return first_ == nullptr; }
+
+        ~chain()
+        {
+            while(first_)
+            {
+                auto next = first_->next.load(std::memory_order_relaxed);
+                owner_->free_node(first_);
+                first_ = next;
+            }
+        }
+
+    private:
+        MRMWQueue* owner_;
+        Node<T>* first_;
+    };
+
+    template<typename It>
+    void enq_range(It first, It last)
+    {
+        if(first == last)
+        {
+            return;
+        }
+
+        Node<T>* chainHead = make_node(*first);
+        Node<T>* chainTail = chainHead;
+        for(++first; first != last; ++first)
+        {
+            auto node = make_node(*first);
+            chainTail->next.store(node, std::memory_order_relaxed);
+            chainTail = node;
+        }
+
+        std::unique_lock<std::mutex> lk{enqLock};
+        tail->next.store(chainHead);
+        tail = chainTail;
+    }
+
+    chain deq_all()
+    {
+        std::unique_lock<std::mutex> deqLk{deqLock};
+        if(head->next.load() == nullptr)
+        {
+            return {};
+        }
+
+        std::unique_lock<std::mutex> enqLk{enqLock};
+        Node<T>* first = head->next.load();
+        head->next.store(nullptr);
+        tail = head;
+        enqLk.unlock();
+        deqLk.unlock();
+
+        return {this, first};
+    }
+
+    void enq(T value)
+    {
+        // allocate outside the critical section
+        auto node = make_node(value);
+
+        std::unique_lock<std::mutex> lk{enqLock};
+        tail->next.store(node);
+        tail = node;
+
+    }
+    std::optional<T> deq()
+    {
+        std::unique_lock<std::mutex> lk{deqLock};
+
+        auto result_node = head->next.load();
+        
+        if(result_node == nullptr)
+        {
+            return std::nullopt;
+        }
+
+        T res = result_node->value;
+
+        auto to_free = head;
+        head = result_node;
+        lk.unlock();
+
+        free_node(to_free);
+        
+        return res;
+    }
+    ~MRMWQueue()
+    {
+        auto curr = head;
+        while(curr)
+        {
+            auto next_curr = curr->next.load();
+            free_node(curr);
+            curr = next_curr;
+        }
+    }
+private:
+    using AllocTraits = std::allocator_traits<Allocator>;
+
+    Node<T>* make_node(T value)
+    {
+        Node<T>* node = AllocTraits::allocate(alloc, 1);
+        new (node) Node<T>{value};
+        return node;
+    }
+
+    void free_node(Node<T>* node)
+    {
+        node->~Node<T>();
+        AllocTraits::deallocate(alloc, node, 1);
+    }
+
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+    [[no_unique_address]]
+    Allocator alloc;
+#else
+    Allocator alloc;
+#endif
+    Node<T>* tail;
+    Node<T>* head;
+    std::mutex deqLock;
+    std::mutex enqLock;
+};